@@ -9,8 +9,14 @@
 #include <string.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <deque>
 #include <SDL/SDL.h>
 #include "RtMidi.h"
+#ifdef __linux__
+#include <sys/inotify.h> //the song-library follows the changes of its folders
+#endif
 
 #ifdef __WINDOWS__KS__ //if kernel-streaming mode is selected
 #include "ks.h"
@@ -86,7 +92,8 @@ signed int MIDI_DIVISION;
 #define GATEON_NOTEFX 0xff
 const int MaxPtnAmount=ORDERLIST_FX_MIN;
 const int MaxPtnLength=256;
-const int PtnColumns=3; //note-column, effect-column, effect-value column
+const int PtnNoteColumns=4; //note-columns of a track: the 1st one and 3 more for chords
+const int PtnColumns=PtnNoteColumns+2; //note-columns, effect-column, effect-value column
 const int MaxSeqLength=255;
 const int TrackAmount=16;
 const int PortAmount=256;
@@ -108,13 +115,29 @@ unsigned char DefaultIns[TrackAmount]={0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0}; //defa
 //Tune-file header end
 unsigned char SEQUENCE[TrackAmount][MaxSeqLength];
 unsigned char PATTLENG[MaxPtnAmount];
-unsigned char PATTERNS[MaxPtnAmount][PtnColumns][MaxPtnLength];
+unsigned char PATTERNS[MaxPtnAmount][MaxPtnLength][PtnColumns]; //rows are packed: the player reads a row from one place
+//Pattern-row description (the order of the columns in the tune-file)
+#define PTN_NOTE 0
+#define PTN_FX 1
+#define PTN_FXVALUE 2
+#define PTN_CHORD 3 //further note-columns, sounding together with PTN_NOTE
+const unsigned char PtnNoteColumn[PtnNoteColumns]={PTN_NOTE,PTN_CHORD,PTN_CHORD+1,PTN_CHORD+2};
 unsigned char INSTRUMENT[MaxInstAmount][InstrumSize]={0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
 //Instrument description
 #define INST_PORT 0
 #define INST_CHVOL 1
 #define INST_PATCH 2
+#define INST_KEYLOW 3 //lowest note the instrument plays (0: no limit)
+#define INST_KEYHIGH 4 //highest note (0: no limit)
+#define INST_TRANSPOSE 5 //semitones added to the notes (signed)
+#define INST_VELOLOW 6 //lowest velocity the notes are played with (0: no limit)
+#define INST_VELOHIGH 7 //highest velocity (0: no limit)
+#define INST_LAYER 8 //instrument sounding together with this one (0: none), layers can be chained
 #define INST_NAME 16
+#define LAYERS_MAX 8 //instruments in a layer-chain (including the first one)
+struct InstRoute { unsigned char Port, Channel, KeyLow, KeyHigh, VeloLow, VeloHigh; signed char Transpose; const unsigned char *Velo; unsigned char Layers, Layer[LAYERS_MAX]; }; //instrument-settings compiled for the emitters
+InstRoute ROUTE[MaxInstAmount]; //rebuilt by CompileRoutes when an instrument changes, the player only looks up here
+unsigned char VeloScale[16][256]; //velocities scaled by the volume-nibble of INST_CHVOL (0 means full volume)
 //END of MUSICDATA-structure description=====================================
 
 
@@ -133,20 +156,102 @@ RtMidiOut *midiout = 0;
 std::vector<unsigned char> PlayerMessage;
 int UsedInPort=0, DispNote=0, InPortCount=0, OutPortCount=0;
 int SelInst=0, MIDIselInst=0xFF, Octave=3, Advance=1, KeyMode=0; //KeyMode=1:Edit, KeyMode=2:Jam
+int InstPage=0; //instrument-fields shown in the instrument-window: 0:port/channel-volume/patch, 1:key-range/transpose, 2:velocity-range/layer
+const int InstPages=3;
 unsigned char HiLight=4; 
 //char TiMinute=00, TiSecond=00;
 char PlayMode=0,PrevPlayMode=0; //0:paused/stopped, 1: Tune-play, 2: pattern-play
-bool FollowPlay=false, AutoFollow=false, fastfwd=false, ExportMode=false; //, FullScreen=false;
-int ffwdspeed=6;
+bool FollowPlay=false, AutoFollow=false, ExportMode=false; //, FullScreen=false;
+bool CompileMode=false, UseTimeline=false; //CompileMode: player runs for the timeline-compiler, UseTimeline: F1 plays the compiled timeline
+int ffwdspeed=6; signed char fastfwd=0; //frames per tick for fast-forward (1) / rewind (-1)
+bool Scrubbing=false, PlayedFromStart=false; //fast-forwarding/rewinding, tune-play started at the beginning (F1)
+#define FILTER_LIVE   0 //redundant-message filter of the MIDI-ports
+#define FILTER_EXPORT 1 //redundant-message filter of the MIDI-export
+unsigned int MessagesSent[2]={0,0}, MessagesSaved[2]={0,0}; //messages passed / dropped by the redundant-message filters
+struct StreamQuality { unsigned short Deadband; unsigned char CCDeadband, Interval; bool Budget; }; //controller-stream shaping presets:
+StreamQuality StreamPresets[4]={ {0,0,1,false}, {16,0,1,true}, {64,1,2,true}, {256,2,4,true} }; //pitch-wheel & controller deadband, min. frames between messages, port-budget used
+int StreamPreset[2]={1,0}; //selected preset for the MIDI-ports and for the export (0: no shaping)
+#define DIN_BUDGET 62 //bytes in a 20ms frame on a 31250 baud MIDI-cable (ports given by 'din <port>' lines of the rig-profile)
+unsigned int PortBudget[PortAmount], BudgetUsed[PortAmount]; //bytes a port can take in a frame (0: unlimited), bytes sent to it in the actual frame
+unsigned int MessagesThinned[2]={0,0}; //pitch-wheel/controller values dropped by the stream-shapers (live/export)
+#define HISTOGRAM_SIZE 8 //log2 buckets: 0, 1, 2-3, 4-7, 8-15, 16-31, 32-63, 64+
+unsigned int QueueDepthHist[HISTOGRAM_SIZE], NoteLatencyHist[HISTOGRAM_SIZE], MessagesMerged=0; //output-scheduler statistics (latency in ms)
+unsigned int SOUNDING[PortAmount][16][4]; //bitset of the keys sounding on the port/channels (note-on sent, note-off not yet)
+unsigned int NotesKilled=0; //note-offs sent by KUSS for notes left sounding
+#define RIG_FILE "MIDItrk.rig" //settings of the MIDI-setup (not of the tune), read at start
+#define LATENCY_MAX 1000 //ms
+unsigned int PortLatency[PortAmount], PortDelay[PortAmount]; //latency of the devices on the ports (ms), time the messages of a port are held back to sound together with the slowest one
+struct DelayedMessage { Uint32 Due; std::vector<unsigned char> Data; };
+std::vector<DelayedMessage> DELAYLINE[PortAmount]; //held-back messages of the ports, in the order of sending
+std::vector<int> DelayedPorts; //ports having messages in their delay-lines
+SDL_mutex *OutputLock=NULL; SDL_cond *OutputSignal=NULL; SDL_Thread *OutputThread=NULL; //the output-thread sends the delay-lines on time
+bool OutputQuit=false; //(the delay-lines, SOUNDING and the writes to the ports are guarded by OutputLock)
+#define MIDI_CLOCK    0xF8
+#define MIDI_START    0xFA
+#define MIDI_CONTINUE 0xFB //after a song-position pointer (F2 lsb msb, in 16th notes = 6 clocks)
+#define MIDI_STOP     0xFC
+std::vector<int> ClockPorts; //ports getting MIDI-clock & transport (rig-profile lines 'clock <port>')
+unsigned int ClockHold=0; //clocks before this one are not sent (after a song-position pointer the clock waits for its 16th note)
+int SlaveMode=0; //the tune-playback follows the MIDI-input: its MIDI-clock & transport, or its timecode (Alt+F5)
+#define SLAVE_CLOCK 1
+#define SLAVE_MTC   2
+#define PLL_PHASE 0.25 //part of the phase-error of a clock corrected at once
+#define PLL_FREQ  0.05 //part of it going into the clock-period
+#define SLAVE_CATCHUP 4 //max. frames played in one round of the main loop when the master speeds up
+SDL_mutex *InputLock=NULL; //guards what the MIDI-input thread shares with the main-thread: the Ext... state of the master, the launch-inbox
+unsigned int ExtClocks=0; //song-position of the master in MIDI-clocks (set by its song-position pointer, counted by its clocks)
+Uint32 ExtClockTicks=0; //SDL-time of the last clock (quarter-frame) counted
+double ExtPeriod=0, ExtJitter=0; //clock-period estimated by the PLL, mean phase-error of the clocks (ms)
+bool ExtPlaying=false, ExtFirstClock=false; //master started/continued (timecode running), its next clock is the song-position itself
+unsigned char ExtTransport=0; //start/continue/stop (timecode located/running) received, handled by the main-thread
+double InputTime=0, PllTime=0, PllPeriod=0; //time of the MIDI-input (ms, summed from the message deltas), phase & period of the PLL
+#define MIDI_QUARTERFRAME 0xF1 //MIDI Time Code: 8 quarter-frames (2 frames) carry a timecode hh:mm:ss:ff, 4 of them in every frame
+#define MTC_LOCATE  0xF0 //full-frame message received (the timecode-master located, it's stopped there)
+#define MTC_TIMEOUT 100 //ms without quarter-frames: the timecode stopped
+#define MTC_WINDOW  10 //frames (20ms) the player may be off the timecode before seeking there (within it the player waits or catches up)
+std::vector<int> MtcPorts; //ports getting MIDI Time Code (rig-profile lines 'mtc <port>')
+unsigned int MtcFps=25; //frame-rate of the sent timecode: 24, 25 or 30 (rig-profile line 'mtcfps <fps>')
+unsigned int MtcStart[4]={0,0,0,0}; //timecode of the start of the tune, hh mm ss ff (rig-profile line 'mtcstart hh:mm:ss:ff')
+unsigned int ExtQuarters=0; //timecode-position of the master in quarter-frames from 00:00:00:00 (at the last quarter-frame received)
+double ExtFrameLength=40; //ms in a timecode-frame of the master (24, 25, 29.97-drop or 30 fps)
+unsigned char MtcNibble[8], MtcPiece=0; unsigned int MtcRun=0; double MtcLast=0; //received quarter-frames, their run of pieces in order
+bool Chasing=false; //the player runs with the timecode of the master
+#define LIBRARY_FILE "MIDItrk.lib" //index-cache of the song-library, in the working folder like the rig-profile
+#define LIBRARY_SLICE 64 //folder-entries checked in a round of the main loop
+struct LibraryEntry { std::string Path, Instruments; long long Mtime, Size; unsigned int Frames; unsigned char Tracks, Patterns, Instrs; bool Seen; };
+std::vector<LibraryEntry> LIBRARY; //the indexed tunes: header-settings, instrument-names, length (Frames)
+std::map<std::string,unsigned int> LibraryIndex; //position of a path in LIBRARY
+std::string LibraryCache=LIBRARY_FILE; //path of the index-cache, made absolute at start (the file-selector changes the working folder)
+std::vector<std::string> LibraryRoots, LibraryFolders, LibraryPending; //library-folders (rig-profile lines 'library <folder>'), folders to read, tunes to read again
+DIR *LibraryDir=NULL; std::string LibraryPath; //folder being read
+bool LibraryScanning=false, LibraryDirty=false; //a whole pass over the folders is running (what's not found is dropped at its end), the cache is to be written
+#define LIBRARY_QUEUE 16 //tunes given to the indexer-thread at a time
+SDL_mutex *LibraryLock=NULL; SDL_cond *LibrarySignal=NULL; SDL_Thread *LibraryThread=NULL; bool LibraryQuit=false; //indexer-thread
+std::deque<LibraryEntry> LibraryJobs, LibraryResults; unsigned int LibraryQueued=0; //tunes to read / read by the indexer (LibraryLock), given and not taken back yet
+unsigned int LibraryChanges=0; //counts the changes of LIBRARY (the search-list is rebuilt on it)
+int LibraryNotify=-1; std::map<int,std::string> LibraryWatches; //inotify-handle (-1: none, the library is read again on opening it) and its folders
+bool Previewing=false; //a tune of the library plays on the spare music-data
+#define SETLIST_END 0xFFFF //switch to the next tune of the setlist at the end of the tune (instead of an orderlist-position)
+struct SetlistEntry { std::string Path; unsigned int Switch; }; //Switch: orderlist-position of the 1st track, where the next tune follows
+std::vector<SetlistEntry> SETLIST; //rig-profile lines 'setlist <tune-file> [@<orderlist-position>]'
+int SetlistPos=-1, NextLoaded=-1; //the tune of the setlist playing (-1: not playing a setlist), the one waiting preloaded in NextTune
+unsigned int SetlistWait=0, SetlistTracks=0; int SetlistSeq=0; //frames till the switch (0: none due), tracks & position before the frame
+int SetlistChecked=-1; //the setlist-position whose next tune was looked for
+int SetlistReading=-1; bool SetlistGo=false; //the setlist-position being read into NextTune by the reader-thread, it's switched to when read (Alt+F8)
 
 int PattPosX=2, PattPosY=4, PattDimX=8, PattDimY=40, OrdListPosX=PattPosX, OrdListPosY=48, OrDimX=20, OrDimY=8, InsDimX=3, InsDimY=7, StatPosY=(WinSizeY/CharSizeY)-1;
 int InstPosX=68, InstPosY=OrdListPosY;
 Uint8* keystate; 
+Uint8 KeyState[SDLK_LAST]; //keys held as told by the key-events, a tap shorter than a frame is caught too
+Uint8 KeyDispatch[SDLK_LAST]; //what the key-handler sees: the modifiers and the key of the event (or the auto-repeating one)
+int RepeatKey=0; //the last key pressed (not a modifier), it auto-repeats while held
+Uint32 KeyArrival; bool KeyFresh=false; //SDL_GetTicks() when the key-event was taken (it waited 1ms at most in the queue), a note of it is still to be measured
+unsigned int KeyLatencyHist[HISTOGRAM_SIZE]; //key-event to jam-note sent (ms, with the latency-compensation of the port)
 int CurPosX=0,CurPosY=0;
 int CurColor=0x00, ColDir=1;
 int CurWide=3; //1 or 3 depending on note/value position
-char repspd1=12, repspd2=2;
-char repecnt=0;
+char repspd1=12, repspd2=2; //auto-repeat delay & rate in 20ms units
+Uint32 RepeatTime=0; //SDL_GetTicks() of the next auto-repeat (0: fresh keypress)
 int PrevCurX,PrevCurY;
 
 char Window=0;  //0=pattern-window, 1=orderlist, 2=instrument/menu?
@@ -154,9 +259,26 @@ char WinPos1[4]={0,0,0,0}, WinPos1Max[4]={PattDimX-1,OrDimX-1,InsDimX-1,0}, WinP
 char TrkPos=0; //display-position of the track-frame in the whole track-field
 bool ESCapes=false;
 
-SDL_TimerID FrameClk;
+SDL_TimerID FrameClk, BlinkClk;
 #define TIMEREVENT_CODE 33
+#define BLINKEVENT_CODE 34 //cursor-blinking
+#define WAKEEVENT_CODE 35 //MIDI-input arrived
+#define CURSOR_BLINK 100 //ms between cursor-steps
+#define IDLE_FRAMES 250 //frames with nothing to do before the main loop sleeps (5 seconds)
 const int TimerInterval=20; //20ms (50Hz) timer
+bool TimersOn=false, Sleeping=false; //timers running, no timers till the next key/mouse/window-event or MIDI-input
+bool WakePending=false; //a wake-event of the MIDI-input is queued and not taken yet (InputLock)
+int Overlay=0; //dialogs open: the player runs on under them, only the screen and the keys are theirs
+SDL_mutex *PlayerLock=NULL; SDL_cond *PlayerSignal=NULL; SDL_Thread *PlayerThread=NULL; bool PlayerQuit=false; //player-thread (the main thread holds the lock except while it waits)
+bool InPlayer=false; int PlayerRedraw=0; //the player-thread is in a frame, the parts of the screen it changed (REDRAW_...) for the main thread
+Uint32 PlayerTicks=0; //SDL_GetTicks() of the next frame of the player-thread
+#define PLAYER_CATCHUP 5 //frames played at once at most after the main thread held the player up (loading, export)
+#define REDRAW_ALL 1
+#define REDRAW_PATTERN 2
+#define REDRAW_COUNTERS 4
+#define REDRAW_TRACKINFO 8
+#define REDRAW_TIME 16
+unsigned int IdleFrames=0;
 
 RtMidiOut *PortOut[PortAmount];
 int pattpos; 
@@ -244,16 +366,16 @@ void put2digit (int x, int y, char number); void put1digit (int x, int y, char n
 void PutString(int x, int y, const std::string& Gstring); //char ascii2petscii(char Character);
 void PutString(int x, int y, const std::string& Gstring, int length); //for some cases
 void DisplayStatic(), Display(); void DispOrderL(); void DispInstr(); void DispCursor(); void DisplayTime();
-int EnumDevices(); void KeyHandler(); void RefreshCursor (), DisplaySettings(); void DisPattData();
+int EnumDevices(); void KeyHandler(); bool KeyModifier(int key); void RefreshCursor (), DisplaySettings(); void DisPattData();
 void put1hex (int x, int y, unsigned char number); void put2hex (int x, int y, unsigned char number);
 void WaitKeyPress(); char ascii2petscii(char Char);
-void SetTimer(); void RemoveTimer(); void InitMusicData(bool putTemplate); int AlertBox(const char* text);
+void SetTimer(); void RemoveTimer(); void PlayerStart(); void PlayerStop(); int EventWait(SDL_Event *ev); bool Busy(); void IdleSleep(); void IdleWake(); void WakeTaken(); void FrameTick(); void LoopService(); void InitMusicData(bool putTemplate); int AlertBox(const char* text);
 void InitGUI(), DisplayHelp(); void DispMIDIevent();
 unsigned char HexKeyVal(); unsigned char NoteKeyVal(); unsigned char NumPadKeyVal(); void EnterNote(); void EnterHex(); 
 void InitRoutine(); void PlayRoutine(); void DisPattCnt(int j); void DispSeqCnt(int i);
 void SetInDevice(int port); void SelectIns(unsigned char instr); void DispTrkInfo();
 int TypeFileName(); int LoadTune(); int SaveTune(); int ExportMIDI(); void DisplayGMset();
-void AllNotesOff(unsigned char instr); int CarefulMessage(unsigned char instr);
+void AllNotesOff(unsigned char instr); void CompileRoute(unsigned char instr); void CompileRoutes(); int CarefulMessage(unsigned char instr); void PortSend(int port, std::vector<unsigned char> *message); int PortDelayFlush(); void OutputStart(); void OutputStop(); void LoadRigProfile(); void KUSS();
 void MessageToExport(unsigned char instr); void ToggleFullScreen(); void ChangeMouseCursor();
 void XPMtoPixels(char* source[], unsigned char* target); void ResetPos();
 void WaitKeyRelease(); void WaitButtonRelease(); int cmpstr(char *string1, char *string2);
@@ -261,20 +383,26 @@ void MIDIcallback( double deltatime, std::vector< unsigned char > *message, void
 void CurUp(); void CurDown(); int MouseField(); void SoloUnsolo(int track);
 char* FilExt(char *filename); void CutExt(char *filename); void ChangeExt(char *filename,char *newExt);
 int LoadTuneFile(); inline bool fexists (const std::string& name);
+struct ChannelState; void ChannelMessage(ChannelState *states, unsigned char instr); void FilterMessage(ChannelState *states, unsigned char instr, int filter); void ShaperFrame(int filter); void ShaperReset(int filter); void SlotMessage(int slot); void ScheduleMessage(int port); void ScheduleFlush(); void PlayFrame(); void FrameEnd(); void PlayTrack(int i); void AdvanceRow(int i, int chptn); void SetTempo(int i, int value); bool RowDue(int i); void ResetPlayerState(bool PlayFromBeginning); unsigned int ClockRate(); void ClockFrame(); void ClockTransport(unsigned char status); void ClockRewind();
+void ClockInput(unsigned char status, std::vector<unsigned char> *message); void SlaveFrames(); void ScanToClock(unsigned long long pos);
+void MtcFrame(); void MtcLocate(); void MtcInput(std::vector<unsigned char> *message); void ChaseFrames();
+void TimelineRecord(unsigned char instr); void TimelineMark(int i, unsigned char type, int value); void TimelineRamp(int i, int value, int step);
+void TimelineSeqEntered(int i, int pos); void TimelineInstrUsed(unsigned char ins); void TimelineCompile(int frames); void TimelineBackground(); void TimelineFrame(); void TimelineStart();
+void TimelineStop(); void DispTiming(); void SeekMarkers(); void Scrub(int frames); void ScrubEnd(); void DirtyPattern(unsigned char ptn); void DirtySequence(int track, int pos); void DirtyInstrument(unsigned char ins); void DirtyTune();
+void LibraryLoad(); void LibraryBackground(); void LibraryStop(); int LibraryBrowser();
+void SetlistBackground(); void SetlistNext(); void SetlistFrame(); void SetlistArm(); void SetlistCancel();
+bool LaunchLive(); void LaunchQueue(int i, unsigned char type, unsigned char value); void LaunchClear(); void LaunchInput(); void LaunchRow(int i); void LaunchRevive(); void ScanTo(unsigned int frame);
 
 //*****************************************************************************************************
 //=============================MAIN ROUTINE============================================================
 int main(int argc, char *argv[]) 
 {
- int i, PortChkTimer=0, PortChkPeriod=100;
+ int i;
 	
  printf("\nMIDItrk 1.0 - a fast & dirty MIDI tracker by Hermit (Mihaly Horvath) in 2013\n");
 
  //--------------------MIDI initialization-----------------------
- EnumDevices();
- midiin->setCallback( &MIDIcallback );
- midiin->ignoreTypes( true, true, true );   //ignore sysex, timing, or active sensing messages.
- SetInDevice(UsedInPort);
+ EnumDevices(); InputLock=SDL_CreateMutex();
                   //midiin->openVirtualPort("MIDItrk-input");    //seems not supported on Windows (no matter if mm/ks)
                   //midiout->openVirtualPort("MIDItrk-output"); //seems not supported on Windows (no matter if mm/ks)
  for (i=0; i<PortAmount; i++) 
@@ -284,11 +412,17 @@ int main(int argc, char *argv[])
   {
    try {PortOut[i]->openPort(i);} catch ( RtError &error ) {error.printMessage();}
   }
+  PortBudget[i]=0;
  }
+ LoadRigProfile(); LibraryLoad(); OutputStart(); PlayerStart();
+ for (i=0; i<16*256; i++) VeloScale[i/256][i%256] = (i/256) ? ((i%256)*(i/256))/16 : i%256;
 
  //---------------------SDL initialization-----------------------
 
  SDL_Init(SDL_INIT_AUDIO | SDL_INIT_VIDEO | SDL_INIT_TIMER);
+ midiin->setCallback( &MIDIcallback ); //after SDL_Init(): the MIDI-input pushes wake-events
+ midiin->ignoreTypes( true, true, true );   //ignore sysex, timing, or active sensing messages.
+ SetInDevice(UsedInPort);
  
 /* SDL interprets each pixel as a 32-bit number, so our masks must depend
  on the endianness (byte order) of the machine */
@@ -339,6 +473,7 @@ int main(int argc, char *argv[])
   }
   else {printf("\nFile was not found, exiting...\n");exit(1);}
  }
+ else if (SETLIST.size()) SetlistNext(); //the first tune of the setlist
 
  InitGUI();
 
@@ -346,120 +481,122 @@ int main(int argc, char *argv[])
  
  bool done=false;
  //main event-handler loop
- while(!done) 
+ while (!done && EventWait(&event)) //the next event: frame-/cursor-timer, key, mouse, window or MIDI-input (the player-thread plays meanwhile)
  {
-  while (SDL_PollEvent(&event))
+  if (Sleeping)
   {
-   if(event.type==SDL_KEYDOWN)
-   { //main keys 
-       //printf("%2X ",event.type); //printf("%2x ",event.key.keysym.sym);
-    switch (event.key.keysym.sym) //be careful with threads
-    {
-     case SDLK_F8: LoadTune(); //load
-        break;
-     case SDLK_F9: //save worktune / export MIDI
-        keystate = SDL_GetKeyState(NULL);
-        if (!keystate[SDLK_LSHIFT] && !keystate[SDLK_RSHIFT]) SaveTune(); else ExportMIDI(); //save
-        break;
-     case SDLK_F10: 
-        RemoveTimer();
-        if (AlertBox("Do you want to clear the whole tune? Y/N"))
-        {
-         InitMusicData(false); Display(); 
-        }
-        SetTimer();
-        break;
-     case SDLK_F11: keystate = SDL_GetKeyState(NULL);
-        if (keystate[SDLK_LALT] || keystate[SDLK_RALT]) 
-           ToggleFullScreen();
-        break;
-     case SDLK_F12: //help
-        RemoveTimer(); DisplayHelp();
-        InitGUI(); SetTimer();
-        break;
-     case SDLK_RETURN: //show General MIDI instrument set
-        if (Window==2) { RemoveTimer(); DisplayGMset(); InitGUI(); SetTimer(); }
-        break;
-     case SDLK_ESCAPE: //quit
-        ESCapes=true; 
-        break;
-         
-     default: break;
-    }
+   if (event.type==SDL_USEREVENT && (event.user.code==TIMEREVENT_CODE || event.user.code==BLINKEVENT_CODE)) continue; //left from before sleeping
+   IdleWake();
+  }
+  if(event.type==SDL_KEYDOWN)
+  { //main keys 
+   KeyState[event.key.keysym.sym]=1;
+   if (!KeyModifier(event.key.keysym.sym))
+   { //handled on arrival, jam/edit-notes go out right now, not at the next frame (a modifier is only taken with the next key)
+    RepeatKey=event.key.keysym.sym; RepeatTime=0;
+    KeyArrival=SDL_GetTicks(); KeyFresh=true; KeyHandler(); KeyFresh=false;
    }
-    
-   else if (event.type == SDL_USEREVENT && event.user.code==TIMEREVENT_CODE)
+      //printf("%2X ",event.type); //printf("%2x ",event.key.keysym.sym);
+   switch (event.key.keysym.sym) //be careful with threads
    {
-    if (!INSTRUMENT[SelInst][0] && !INSTRUMENT[SelInst][1] && !INSTRUMENT[SelInst][2]) DispNote=0; //avoid loopback/feedback at least for empty instruments
-    /*if (MIDIselInst!=0xFF) //selecting instrument through MIDI-input? - on Linux Midi-thourgh causes loop
-    {
-     SelInst=MIDIselInst; SelectIns(SelInst); DispInstr(); MIDIselInst=0xFF;
-    }*/
-    KeyHandler();
-    DispCursor();
-    if (PlayMode>0) {PlayRoutine();DisplayTime();}
-    DispMIDIevent();
-    if (PortChkTimer--<=0)
-    {
-     PortChkTimer=PortChkPeriod; i=midiin->getPortCount();
-     if (InPortCount!=i) //check if change happened meanwhile
-     {
-      SetInDevice(UsedInPort); //if MIDI controller connected/disconnected, refresh callback & display 
-      DisplaySettings();
-     }
-     InPortCount=i;
-    }
+    case SDLK_F8: keystate = SDL_GetKeyState(NULL); //load tune / search the song-library / next tune of the setlist
+       if (keystate[SDLK_LALT] || keystate[SDLK_RALT]) SetlistNext();
+       else if (!keystate[SDLK_LSHIFT] && !keystate[SDLK_RSHIFT]) LoadTune(); else LibraryBrowser();
+       break;
+    case SDLK_F9: //save worktune / export MIDI
+       keystate = SDL_GetKeyState(NULL);
+       if (!keystate[SDLK_LSHIFT] && !keystate[SDLK_RSHIFT]) SaveTune(); else ExportMIDI(); //save
+       break;
+    case SDLK_F10: 
+       if (AlertBox("Do you want to clear the whole tune? Y/N"))
+       {
+        KUSS(); InitMusicData(false); Display(); 
+       }
+       break;
+    case SDLK_F11: keystate = SDL_GetKeyState(NULL);
+       if (keystate[SDLK_LALT] || keystate[SDLK_RALT]) 
+          ToggleFullScreen();
+       break;
+    case SDLK_F12: //help
+       DisplayHelp(); InitGUI();
+       break;
+    case SDLK_ESCAPE: //quit
+       ESCapes=true; 
+       break;
+        
+    default: break;
    }
+  }
+   
+  else if (event.type==SDL_KEYUP)
+  {
+   KeyState[event.key.keysym.sym]=0;
+   if (event.key.keysym.sym==RepeatKey) { RepeatKey=0; KeyHandler(); } //jam-note off at once
+  }
+   
+  else if (event.type == SDL_USEREVENT && event.user.code==TIMEREVENT_CODE) FrameTick();
+
+  else if (event.type == SDL_USEREVENT && event.user.code==BLINKEVENT_CODE) DispCursor();
 
-   else if (event.type == SDL_MOUSEBUTTONDOWN)
+  else if (event.type == SDL_USEREVENT && event.user.code==WAKEEVENT_CODE) { WakeTaken(); KeyHandler(); LaunchInput(); } //a note played through at once (the player-thread follows the clock/timecode)
+
+  else if (event.type == SDL_MOUSEBUTTONDOWN)
+  {
+   unsigned char mouseChX=event.button.x/CharSizeX, mouseChY=event.button.y/CharSizeY;
+   if (event.button.button==SDL_BUTTON_LEFT)
    {
-    unsigned char mouseChX=event.button.x/CharSizeX, mouseChY=event.button.y/CharSizeY;
-    if (event.button.button==SDL_BUTTON_LEFT)
-    {
-     if (event.button.y<38 && (event.button.x>WinSizeX-32 || event.button.x<32))
-     { 
-      if (event.button.x<32 || event.button.y>24) { RemoveTimer(); DisplayHelp(); InitGUI(); SetTimer(); } //help-button
-      else if (event.button.y<20)
-      { //buttons at the top
-       if (event.button.x>=WinSizeX-17) ESCapes=true;
-       else if (event.button.x>=WinSizeX-32 && event.button.x<WinSizeX-20) { WaitButtonRelease(); ToggleFullScreen(); }
-      }
+    if (event.button.y<38 && (event.button.x>WinSizeX-32 || event.button.x<32))
+    { 
+     if (event.button.x<32 || event.button.y>24) { DisplayHelp(); InitGUI(); } //help-button
+     else if (event.button.y<20)
+     { //buttons at the top
+      if (event.button.x>=WinSizeX-17) ESCapes=true;
+      else if (event.button.x>=WinSizeX-32 && event.button.x<WinSizeX-20) { WaitButtonRelease(); ToggleFullScreen(); }
      }
-     else if (MouseField()==0) {Window=0;WinPos1[0]=(mouseChX-PattPosX-1)/9; WinPos2[0]=mouseChY-PattPosY-2; Display();}
-     else if (MouseField()==1) {Window=1;WinPos1[1]=(mouseChX-OrdListPosX-2)/3; WinPos2[1]=mouseChY-OrdListPosY-2; Display();}
-     else if (MouseField()==2) {Window=2;WinPos1[2]=(mouseChX-InstPosX-2)/3; Display();}
-     else if (MouseField()==3) {mutesolo[TrkPos+(mouseChX-PattPosX-1)/9]^=true; Display();}
-    }
-    else if (event.button.button==SDL_BUTTON_RIGHT)
-    {
-     if (MouseField()==3) SoloUnsolo( TrkPos+(mouseChX-PattPosX-1)/9 );
-    }
-    else if (event.button.button==SDL_BUTTON_WHEELUP)
-    {
-     if (MouseField()==0) {for(i=0;i<8;i++) if(pattpos>0 && !FollowPlay) pattpos--; DisPattData();}
-     else if (MouseField()==1) { if (TrkPos>0) TrkPos--; Display();}
-     else if (MouseField()==2) { if (SelInst>0) {SelInst--; SelectIns(SelInst); DispInstr();}}
-    }
-    else if (event.button.button==SDL_BUTTON_WHEELDOWN)
-    {
-     if (MouseField()==0) {for(i=0;i<8;i++) if(pattpos<0x100-PattDimY && !FollowPlay) pattpos++; DisPattData();}
-     else if (MouseField()==1) { if (TrkPos<TrackAmount-OrDimY) TrkPos++; Display();}
-     else if (MouseField()==2) { if (SelInst<MaxInstAmount-1) {SelInst++;SelectIns(SelInst); DispInstr();} }
     }
+    else if (MouseField()==0) {Window=0;WinPos1[0]=(mouseChX-PattPosX-1)/9; WinPos2[0]=mouseChY-PattPosY-2; Display();}
+    else if (MouseField()==1) {Window=1;WinPos1[1]=(mouseChX-OrdListPosX-2)/3; WinPos2[1]=mouseChY-OrdListPosY-2; Display();}
+    else if (MouseField()==2) {Window=2;WinPos1[2]=(mouseChX-InstPosX-2)/3; Display();}
+    else if (MouseField()==3) {mutesolo[TrkPos+(mouseChX-PattPosX-1)/9]^=true; Display();}
    }
-
-   else if (event.type == SDL_QUIT || ESCapes)
+   else if (event.button.button==SDL_BUTTON_RIGHT)
+   {
+    if (MouseField()==3) SoloUnsolo( TrkPos+(mouseChX-PattPosX-1)/9 );
+   }
+   else if (event.button.button==SDL_BUTTON_WHEELUP)
+   {
+    if (MouseField()==0) {for(i=0;i<8;i++) if(pattpos>0 && !FollowPlay) pattpos--; DisPattData();}
+    else if (MouseField()==1) { if (TrkPos>0) TrkPos--; Display();}
+    else if (MouseField()==2) { if (SelInst>0) {SelInst--; SelectIns(SelInst); DispInstr();}}
+   }
+   else if (event.button.button==SDL_BUTTON_WHEELDOWN)
    {
-    RemoveTimer();
-    if (!AlertBox("Are You sure to quit? Y/N")) {ESCapes=done=false; SetTimer();} //goto retreat;}
-    else {done=true;}
+    if (MouseField()==0) {for(i=0;i<8;i++) if(pattpos<0x100-PattDimY && !FollowPlay) pattpos++; DisPattData();}
+    else if (MouseField()==1) { if (TrkPos<TrackAmount-OrDimY) TrkPos++; Display();}
+    else if (MouseField()==2) { if (SelInst<MaxInstAmount-1) {SelInst++;SelectIns(SelInst); DispInstr();} }
    }
   }
-  SDL_Delay(1);
+
+  if (event.type == SDL_QUIT || ESCapes)
+  {
+   if (!AlertBox("Are You sure to quit? Y/N")) {ESCapes=done=false;} //goto retreat;}
+   else {done=true;}
+  }
  }
 
- RemoveTimer();
+ RemoveTimer(); PlayerStop();
+ KUSS(); //no hung notes left behind
+ ClockTransport(MIDI_STOP); OutputStop(); //held-back messages go out before the ports close
+ LibraryStop(); SetlistCancel();
  SDL_Quit();
+ std::cout << "\nMIDI-out: " << MessagesSent[FILTER_LIVE] << " messages sent, " << MessagesSaved[FILTER_LIVE] << " redundant ones saved, " << MessagesThinned[FILTER_LIVE] << " pitch-wheel/controller values thinned, " << NotesKilled << " sounding notes stopped.\n";
+ std::cout << "Output-scheduler: " << MessagesMerged << " waiting messages updated. Histograms (0, 1, 2-3, 4-7, 8-15, 16-31, 32-63, 64+):\n Note latency (ms):";
+ for (i=0;i<HISTOGRAM_SIZE;i++) std::cout << " " << NoteLatencyHist[i];
+ std::cout << "\n Queue depth (messages of a port in a frame):";
+ for (i=0;i<HISTOGRAM_SIZE;i++) std::cout << " " << QueueDepthHist[i];
+ std::cout << "\n Key to jam-note latency (ms):";
+ for (i=0;i<HISTOGRAM_SIZE;i++) std::cout << " " << KeyLatencyHist[i];
+ std::cout << "\n";
  delete midiin;
  delete midiout;
  
@@ -485,279 +622,1903 @@ int MouseField()
 //========================================== MUSIC-PLAYER ROUTINE==========================================
 #define deftempo 6
 int PATTCNT[TrackAmount], SEQCNT[TrackAmount];
-unsigned char prevnote[TrackAmount]={0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0}, PrevJamNote=0;
+unsigned char prevnote[TrackAmount][PtnNoteColumns], PrevJamNote=0; //the last note of every note-column of the tracks
+#define LAUNCH_PATTERN 0 //launch: the track loops the pattern
+#define LAUNCH_SEQPOS 1 //launch: the track continues its orderlist from the position
+#define LAUNCH_QUEUE 8 //launches waiting on a track
+#define LAUNCH_INBOX 64 //launch-notes of the MIDI-input waiting for the main thread
+struct Launch { unsigned char Type, Value; bool AtEnd; }; //AtEnd: at the end of the playing pattern (not at the next HiLight-row)
+std::vector<Launch> LAUNCHQUEUE[TrackAmount]; //pattern-/orderlist-changes waiting for their row
+unsigned char LAUNCHED[TrackAmount]={0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF}; //pattern looped by a launch (0xFF: the orderlist plays)
+bool LaunchAtEnd=false; //Ctrl+L: launches wait for the end of the pattern instead of the next HiLight-row
+int LaunchChannel=-1; //rig-profile 'launch <MIDI-channel>': note-ons there launch pattern <note> on the 1st track, on the next channels on the next tracks
+unsigned short LaunchInbox[LAUNCH_INBOX]; unsigned int LaunchInboxIn=0, LaunchInboxOut=0; //track*256+pattern, written by the MIDI-thread (InputLock)
 int SPDCNT[TrackAmount]={0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
 int TEMPO[TrackAmount]={deftempo,deftempo,deftempo,deftempo,deftempo,deftempo,deftempo,deftempo,deftempo,deftempo,deftempo,deftempo,deftempo,deftempo,deftempo,deftempo};
 int DELAYCNT[TrackAmount]={-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1};
+#define defrowsperbeat 4
+#define TEMPO_BPM 0x100 //SetTempo(): 0xx BPM-effect values are given above the Fxx frame-tempo values
+#define ROWCLOCK_FRAME 0x10000 //a 20ms frame in the fixed-point row-clock
+unsigned char BPM[TrackAmount], ROWSPERBEAT[TrackAmount]; //BPM-tempo of the tracks (0: frame-based TEMPO) and rows in a beat
+unsigned int ROWLENGTH[TrackAmount], ROWCLOCK[TrackAmount]; //BPM-tempo: length of a row and time since the last row in 1/65536 frames
+unsigned char TuneBPM=0; //BPM set for all tracks, the tempo-map of the MIDI-export follows it (0: frame-based tempo)
+struct TuneTiming //the row-timing state of the tracks: the player's arrays, or the ones of a tune being measured
+{
+ int *SeqCnt, *PattCnt, *SpdCnt, *Tempo, *DelayCnt;
+ unsigned char *Bpm, *RowsPerBeat, *TuneBpm; unsigned int *RowLength, *RowClock;
+};
+TuneTiming PlayerTiming={SEQCNT,PATTCNT,SPDCNT,TEMPO,DELAYCNT,BPM,ROWSPERBEAT,&TuneBPM,ROWLENGTH,ROWCLOCK};
 unsigned char PLAYEDINS[TrackAmount]={0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0};
 bool EndOfTune=false, EndOfTrack[TrackAmount]={false,false,false,false,false,false,false,false,false,false,false,false,false,false,false,false};
 unsigned char F2playMarker[TrackAmount]={0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
 bool Vibrato[TrackAmount]={false,false,false,false,false,false,false,false,false,false,false,false,false,false,false,false};
 int SlideSpeed[TrackAmount]={0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0};
 int SlideCnt[TrackAmount]={0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0};
+unsigned int PLAYFRAME=0; //20ms frames played since the start of the tune
+int CurrentTrack=0; //the track being processed by the player (compiled events are recorded for this track)
+int CurrentColumn=0, NoteColumn=0; //note-column being played (recorded with note-events), note-column shown in the pattern-editor
+bool Looped[TrackAmount]={false,false,false,false,false,false,false,false,false,false,false,false,false,false,false,false}; //track took an orderlist-jump (timeline-compiler)
+#define TICKFX_MIN 0x80 //9xx: 00..7F delays the track by frames, 8y..Dy are sub-row (tick) effects lasting till the end of the row
+#define TICK_RETRIGGER 0 //98y: the track's notes again in every y frames
+#define TICK_FADEOUT   1 //99y: retrigger with velocity going down a step each time
+#define TICK_FADEIN    2 //9Ay: retrigger with velocity going up a step each time
+#define TICK_CUT       3 //9By: note-off y frames into the row
+#define TICK_DELAY     4 //9Cy: the notes of the row start y frames later (the other effects and the row-timing don't move)
+#define TICK_ARPEGGIO  5 //9Dy: the chord of the row is played note by note, a step in every y frames
+struct TickEffect { unsigned char Handler, Frames, Count, Step, Amount, Velo; signed char Ramp; unsigned char Notes[PtnNoteColumns]; };
+TickEffect TICKFX[TrackAmount]; //tick-effect state of the tracks, packed for the one pass of TickFrame()
+unsigned int TickActive=0; //bit 'i': track 'i' has a running tick-effect
+unsigned int TRACKWAIT[TrackAmount]; //frames till the next row when the track only has to count (0: PlayTrack checks everything)
+unsigned long long CLOCKPOS=0; //song-position in 1/65536 MIDI-clocks (24 in a beat), player-state so seeking knows it too
+unsigned int TracksPlaying=0; //bit 'i': track 'i' hasn't ended, the player skips the ended ones and EndOfTune needs no scan
+
+//compiled event timeline
+#define TLEV_MIDI   0 //routed MIDI-message, replayed as it is
+#define TLEV_NOTEON 1 //note-on, skipped for muted tracks
+#define TLEV_NOTEOFF 2 //note-off, sent to the previously played note of the track
+#define TLEV_RAMP   3 //pitch-wheel slide: Value+Step*n for Count frames
+#define TLEV_INSTR  4 //instrument change (Cxx)
+#define TLEV_TEMPO  5 //tempo change (Fxx, 0xx as TEMPO_BPM+xx)
+#define TLEV_ROW    6 //a pattern-row is played: Value=orderlist-position, Step=pattern-row
+#define TLEV_JUMP   7 //orderlist-jump to position Value
+#define TLEV_END    8 //end of the track
+#define TIMELINE_CHECKPOINT 250 //frames between saved player-states (5 seconds)
+#define TIMELINE_SLICE 1000 //frames compiled at a time when the timeline is needed at once
+#define TIMELINE_BATCH 25 //frames compiled in the background between two checks of the time
+#define TIMELINE_SLICE_MS 3 //ms of background-compiling in a timer-event
+#define TIMELINE_MAXFRAMES (50*60*60) //1 hour, the interpreter continues afterwards
+#define TIMELINE_UNKNOWN 0xFFFFFFFF //orderlist-position/pattern not reached yet
+
+struct TimelineEvent
+{
+ unsigned int Frame; //the 20ms frame of the event
+ unsigned char Type, Instr, Size; //event-type, instrument used for routing, length of MIDI-message
+ unsigned char Data[6]; //MIDI-message (Portamento sends 2 messages at once)
+ int Value, Step, Count; //pitch-ramp / marker parameters
+};
+
+//MIDI-channel state (what the song has set on the used port/channel pairs till the player's position)
+#define CHANNEL_SLOTS 64 //max. number of different port/channel pairs followed
+#define CHANNEL_UNKNOWN 0xFF //controller/program not set yet (0xFFFF for pitch-wheel)
+struct ChannelState
+{
+ unsigned char Program, Pressure, CC[128]; //CC 0x78..0x7F are channel-mode messages, not stored
+ unsigned short PitchBend; //2 data-bytes of the pitch-wheel message as sent (LSB + MSB*128)
+};
+ChannelState CHANNELS[CHANNEL_SLOTS]; //state of the tune at the position of the compiler/scanner
+ChannelState SynthState[CHANNEL_SLOTS]; //state sent to the MIDI-ports
+ChannelState ExportState[CHANNEL_SLOTS]; //state written to the exported MIDI-file
+#define STREAMS     129 //shaped streams of a channel: controllers 0..127 and the pitch-wheel
+#define STREAM_BEND 128
+unsigned short PendingValue[2][CHANNEL_SLOTS][STREAMS]; unsigned char PendingInstr[2][CHANNEL_SLOTS], PendingCount[2][CHANNEL_SLOTS]; //values held back by the stream-shapers (0xFFFF: none), held streams of a slot
+bool PendingFresh[2][CHANNEL_SLOTS][STREAMS]; unsigned int LastSent[2][CHANNEL_SLOTS][STREAMS], ShaperTick[2]={0,0}; //new value came in this frame, frame of the last sent value
+unsigned char CHSLOT[PortAmount][16]; //slot+1 of a port/channel pair in CHANNELS (0: no slot yet)
+int SlotPort[CHANNEL_SLOTS], SlotChannel[CHANNEL_SLOTS], SlotAmount=0;
+bool ScanMode=false; //CompileMode without recording: the player only follows the state (seek)
+bool Scheduling=false; //messages of the actual frame are queued for the output-scheduler
+
+struct PlayerSnapshot //the whole state of the player at a given frame
+{
+ int PattCnt[TrackAmount], SeqCnt[TrackAmount], SpdCnt[TrackAmount], Tempo[TrackAmount], DelayCnt[TrackAmount];
+ unsigned char Bpm[TrackAmount], RowsPerBeat[TrackAmount], TuneBpm; unsigned int RowLength[TrackAmount], RowClock[TrackAmount];
+ int SlideSpeed[TrackAmount], SlideCnt[TrackAmount];
+ unsigned char PlayedIns[TrackAmount], PrevNote[TrackAmount][PtnNoteColumns];
+ bool EndOfTrack[TrackAmount], Vibrato[TrackAmount], Looped[TrackAmount];
+ TickEffect TickFx[TrackAmount]; unsigned int TickActive; unsigned long long ClockPos;
+ unsigned int TrackWait[TrackAmount]; //the row-countdowns of the idle-track skip
+ unsigned int Frame, Events[TrackAmount]; //the frame and the number of compiled events before it
+ ChannelState Channels[CHANNEL_SLOTS];
+};
+
+std::vector<TimelineEvent> TIMELINE[TrackAmount]; //compiled events of the tracks, sorted by frame
+std::vector<PlayerSnapshot> Checkpoints; //player-state at every TIMELINE_CHECKPOINT frames
+PlayerSnapshot TimelineState; //state of the compiler where it stopped
+unsigned int SEQTICK[TrackAmount][256], PTNTICK[256], INSTTICK[256]; //frame where an orderlist-position / pattern / instrument was first reached
+unsigned int TLCURSOR[TrackAmount]; int TLRAMP[TrackAmount]; //playback-cursors and active pitch-ramps in the timeline
+bool TimelineDone=false, TimelinePlaying=false, TimelineResync=false; //compiled till end, F1 plays timeline, cursors need repositioning
+unsigned int CompileTarget=0; //compiling goes at least till this frame, even if all tracks looped already
+struct SeqEntry { unsigned int Frame; unsigned char Pos; };
+std::vector<SeqEntry> SEQINDEX[TrackAmount]; //timing-index: every entry of the tracks into an orderlist-position, sorted by frame
+unsigned int LOOPTICK[TrackAmount], ENDTICK[TrackAmount]; //frame of the first orderlist-jump (FE xx) and of the end (FF) of the tracks
+unsigned char LOOPPOS[TrackAmount]; //target position of the first jump
+
+void PortWrite(int port, std::vector<unsigned char> *message)
+{ //every message goes to the MIDI-ports here, the sounding notes are followed by it
+ unsigned int i, size; unsigned char status, key;
+ for (i=0;i<message->size();i+=size)
+ {
+  status=message->at(i); size=((status&0xE0)==0xC0)? 2:3; //program-change & channel-pressure have one data-byte
+  if (i+2>=message->size()) break;
+  key=message->at(i+1)&0x7F;
+  switch (status&0xF0)
+  {
+   case 0x90: if (message->at(i+2)) { SOUNDING[port][status&0xF][key/32] |= 1<<(key&31); break; } //velocity 0 is a note-off
+   case 0x80: SOUNDING[port][status&0xF][key/32] &= ~(1<<(key&31)); break;
+   case 0xB0: if (key==0x78 || key==0x7B) memset(SOUNDING[port][status&0xF],0,sizeof(SOUNDING[0][0])); break; //all sound / all notes off
+  }
+ }
+ try{ PortOut[port]->sendMessage( message ); } catch( RtError &error ) {error.printMessage();}
+}
+
+void PortSendLater(int port, std::vector<unsigned char> *message, unsigned int ms)
+{ //hold back a message for 'ms' milliseconds, it goes after the ones due earlier or at the same time
+ DelayedMessage delayed;
+ std::vector<DelayedMessage> &line=DELAYLINE[port];
+ unsigned int i;
+ SDL_LockMutex(OutputLock);
+ if (ms==0 && line.empty()) { PortWrite(port,message); SDL_UnlockMutex(OutputLock); return; }
+ if (line.empty()) DelayedPorts.push_back(port);
+ delayed.Due=SDL_GetTicks()+ms; delayed.Data=*message;
+ for (i=line.size(); i>0 && (Sint32)(line[i-1].Due-delayed.Due)>0; i--);
+ line.insert(line.begin()+i,delayed);
+ SDL_CondSignal(OutputSignal); //the output-thread may wait for a later one
+ SDL_UnlockMutex(OutputLock);
+}
+
+void PortSend(int port, std::vector<unsigned char> *message)
+{ //send now, or hold back by the latency-compensation of the port
+ PortSendLater(port,message,PortDelay[port]);
+}
+
+int PortDelayFlush()
+{ //send the held-back messages that are due, returns the ms till the next one (-1: none), OutputLock is held by the caller
+ Uint32 now=SDL_GetTicks(); unsigned int i=0,j; int port, wait=-1;
+ while (i<DelayedPorts.size())
+ {
+  port=DelayedPorts[i]; std::vector<DelayedMessage> &line=DELAYLINE[port];
+  for (j=0;j<line.size() && (Sint32)(now-line[j].Due)>=0;j++) PortWrite(port,&line[j].Data);
+  line.erase(line.begin(),line.begin()+j);
+  if (line.empty()) { DelayedPorts[i]=DelayedPorts.back(); DelayedPorts.pop_back(); continue; }
+  if (wait<0 || (int)(line[0].Due-now)<wait) wait=line[0].Due-now;
+  i++;
+ }
+ return wait;
+}
+
+int OutputLoop(void *unused)
+{ //output-thread: the held-back messages (latency-compensation, clocks & timecode inside the frames) go out on their
+  //millisecond, whatever the main loop does or however long it sleeps
+ int wait;
+ SDL_LockMutex(OutputLock);
+ while (!OutputQuit || DelayedPorts.size())
+ {
+  wait=PortDelayFlush();
+  if (wait<0) { if (!OutputQuit) SDL_CondWait(OutputSignal,OutputLock); }
+  else SDL_CondWaitTimeout(OutputSignal,OutputLock,wait);
+ }
+ SDL_UnlockMutex(OutputLock);
+ return 0;
+}
+
+void OutputStart()
+{
+ OutputLock=SDL_CreateMutex(); OutputSignal=SDL_CreateCond();
+ OutputThread=SDL_CreateThread(OutputLoop,NULL);
+}
+
+void OutputStop()
+{ //the output-thread sends what is left in the delay-lines and ends
+ SDL_LockMutex(OutputLock); OutputQuit=true; SDL_CondSignal(OutputSignal); SDL_UnlockMutex(OutputLock);
+ SDL_WaitThread(OutputThread,NULL); OutputThread=NULL;
+}
+
+void PortDelayClear()
+{ //drop the held-back notes (they aren't sounding yet), clocks & timecode, the rest goes now (the channel-states have it as sent)
+ unsigned int i,j,k,size; int port;
+ std::vector<unsigned char> settings;
+ for (i=0;i<DelayedPorts.size();i++)
+ {
+  port=DelayedPorts[i]; std::vector<DelayedMessage> &line=DELAYLINE[port];
+  for (j=0;j<line.size();j++)
+  {
+   std::vector<unsigned char> &data=line[j].Data;
+   if (data.empty() || data[0]==MIDI_CLOCK || data[0]==MIDI_QUARTERFRAME) continue;
+   if (data[0]>=0xF0) { PortWrite(port,&data); continue; } //system messages are sent one by one
+   settings.clear();
+   for (k=0;k<data.size();k+=size)
+   {
+    size=((data[k]&0xE0)==0xC0)? 2 : 3; if (k+size>data.size()) size=data.size()-k;
+    if ((data[k]&0xE0)!=0x80) settings.insert(settings.end(),data.begin()+k,data.begin()+k+size);
+   }
+   if (settings.size()) PortWrite(port,&settings);
+  }
+  line.clear();
+ }
+ DelayedPorts.clear();
+}
+
+std::string AbsolutePath(const std::string &path)
+{ //a path of the rig-profile from the working folder at start, it stays valid when the file-selector changes folder
+ char cwd[FILENAME_MAX];
+ if (path.empty() || path[0]=='/' || path[0]=='\\' || (path.size()>1 && path[1]==':') || getcwd(cwd,sizeof(cwd))==NULL) return path;
+ if (path==".") return cwd;
+ return std::string(cwd)+"/"+path;
+}
+
+void LoadRigProfile()
+{ //port-latencies from the lines 'latency <port> <ms>' of the rig-profile, faster ports are delayed to the slowest one
+ FILE *rig=fopen(RIG_FILE,"r"); char line[256]; unsigned int port, ms, slowest=0; int i;
+ LibraryCache=AbsolutePath(LIBRARY_FILE);
+ if (rig==NULL) return;
+ while (fgets(line,sizeof(line),rig))
+ {
+  if (sscanf(line,"latency %u %u",&port,&ms)==2 && port<PortAmount) PortLatency[port]=(ms<LATENCY_MAX)? ms : LATENCY_MAX;
+  else if (sscanf(line,"clock %u",&port)==1 && port<PortAmount) ClockPorts.push_back(port);
+  else if (sscanf(line,"mtc %u",&port)==1 && port<PortAmount) MtcPorts.push_back(port);
+  else if (sscanf(line,"din %u",&port)==1 && port<PortAmount) PortBudget[port]=DIN_BUDGET;
+  else if (sscanf(line,"launch %u",&port)==1 && port>=1 && port<=16) LaunchChannel=port-1;
+  else if (!strncmp(line,"setlist ",8))
+  { //the tune-file, an orderlist-position after '@' at the end of the line (if the switch isn't at the end of the tune)
+   SetlistEntry entry; std::string path(line+8); size_t at;
+   while (path.size() && strchr("\r\n ",path[path.size()-1])) path.erase(path.size()-1);
+   entry.Switch=SETLIST_END; at=path.rfind(" @");
+   if (at!=std::string::npos && sscanf(path.c_str()+at+2,"%x",&entry.Switch)==1 && entry.Switch<MaxSeqLength) path.erase(at);
+   else entry.Switch=SETLIST_END;
+   while (path.size() && path[path.size()-1]==' ') path.erase(path.size()-1);
+   entry.Path=AbsolutePath(path); if (path.size()) SETLIST.push_back(entry);
+  }
+  else if (!strncmp(line,"library ",8))
+  { //the rest of the line is the folder
+   std::string folder(line+8);
+   while (folder.size() && strchr("\r\n/ ",folder[folder.size()-1])) folder.erase(folder.size()-1);
+   if (folder.size()) LibraryRoots.push_back(AbsolutePath(folder));
+  }
+  else if (sscanf(line,"mtcfps %u",&ms)==1 && (ms==24 || ms==25 || ms==30)) MtcFps=ms;
+  else if (sscanf(line,"mtcstart %u:%u:%u:%u",&MtcStart[0],&MtcStart[1],&MtcStart[2],&MtcStart[3])==4) { MtcStart[0]%=24; MtcStart[1]%=60; MtcStart[2]%=60; MtcStart[3]%=30; }
+ }
+ fclose(rig);
+ for (i=0;i<PortAmount;i++) if (PortLatency[i]>slowest) slowest=PortLatency[i];
+ for (i=0;i<PortAmount;i++) PortDelay[i]=slowest-PortLatency[i];
+ printf("Port-latencies read from %s, output aligned to the slowest port (%u ms)\n",RIG_FILE,slowest);
+}
+
+void CompileRoute(unsigned char instr)
+{ //route of an instrument from its INSTRUMENT-entry, with the instruments of its layer-chain flattened out
+ InstRoute &route=ROUTE[instr]; unsigned char *inst=INSTRUMENT[instr]; int i, layer;
+ route.Port=inst[INST_PORT]; route.Channel=inst[INST_CHVOL]/16; route.Velo=VeloScale[inst[INST_CHVOL]&0xF];
+ route.KeyLow=inst[INST_KEYLOW]; route.KeyHigh=(inst[INST_KEYHIGH])?inst[INST_KEYHIGH]:0xFF; route.Transpose=inst[INST_TRANSPOSE];
+ route.VeloLow=inst[INST_VELOLOW]; route.VeloHigh=(inst[INST_VELOHIGH])?inst[INST_VELOHIGH]:0xFF;
+ route.Layer[0]=instr; route.Layers=1;
+ for (layer=inst[INST_LAYER]; layer && layer<MaxInstAmount && route.Layers<LAYERS_MAX; layer=INSTRUMENT[layer][INST_LAYER])
+ {
+  for (i=0;i<route.Layers;i++) if (route.Layer[i]==layer) break;
+  if (i<route.Layers) break; //chain looping back
+  route.Layer[route.Layers++]=layer;
+ }
+}
+
+void CompileRoutes()
+{ //all of them, a layer-chain can go through the changed instrument
+ int i;
+ for (i=0;i<MaxInstAmount;i++) CompileRoute(i);
+}
+
+int CarefulMessage(unsigned char instr)
+{
+ if (CompileMode)
+ { //timeline-compiler / seek-scanner mode
+  ChannelMessage(CHANNELS,instr);
+  if (ScanMode) PlayerMessage.clear(); else TimelineRecord(instr);
+ }
+ else if (ExportMode==false)
+ { //playback-mode
+  FilterMessage(SynthState,instr,FILTER_LIVE);
+  if (Scheduling) ScheduleMessage(ROUTE[instr].Port); //the frame's messages are sent by priority at its end
+  else
+  {
+   BudgetUsed[ROUTE[instr].Port]+=PlayerMessage.size();
+   if (PlayerMessage.size()) PortSend(ROUTE[instr].Port,&PlayerMessage);
+  }
+  PlayerMessage.clear(); 
+ }
+ else
+ { //MIDI-export mode
+  FilterMessage(ExportState,instr,FILTER_EXPORT);
+  if (PlayerMessage.size()) MessageToExport(instr); 
+ }
+ return 0;
+}
+
+//-----------------------------------------------
+void LayerMessage(unsigned char instr, unsigned char status, unsigned char data1, int data2)
+{ //channel-message to all layers of an instrument (data2<0: 2-byte message)
+ int i; InstRoute *layer;
+ for (i=0;i<ROUTE[instr].Layers;i++)
+ {
+  layer=&ROUTE[ROUTE[instr].Layer[i]];
+  PlayerMessage.push_back(status+layer->Channel); PlayerMessage.push_back(data1); if (data2>=0) PlayerMessage.push_back(data2);
+  CarefulMessage(ROUTE[instr].Layer[i]);
+ }
+}
+
+void NoteOn(unsigned char instr, unsigned char note, unsigned char velo)
+{ //to the layers whose key- and velocity-range has the note
+ int i, key; InstRoute *layer;
+ for (i=0;i<ROUTE[instr].Layers;i++)
+ {
+  layer=&ROUTE[ROUTE[instr].Layer[i]]; key=note-1+layer->Transpose;
+  if (note<layer->KeyLow || note>layer->KeyHigh || velo<layer->VeloLow || velo>layer->VeloHigh || key<0 || key>0x7F) continue;
+  PlayerMessage.push_back(0x90+layer->Channel); PlayerMessage.push_back(key); PlayerMessage.push_back(layer->Velo[velo]);
+  CarefulMessage(ROUTE[instr].Layer[i]);
+ }
+}
+
+void NoteOff(unsigned char instr, unsigned char note, unsigned char velo)
+{ //velocity-range isn't checked: the note-on's velocity isn't known here
+ int i, key; InstRoute *layer;
+ for (i=0;i<ROUTE[instr].Layers;i++)
+ {
+  layer=&ROUTE[ROUTE[instr].Layer[i]]; key=note-1+layer->Transpose;
+  if (note<layer->KeyLow || note>layer->KeyHigh || key<0 || key>0x7F) continue;
+  PlayerMessage.push_back(0x80+layer->Channel); PlayerMessage.push_back(key); PlayerMessage.push_back(layer->Velo[velo]);
+  CarefulMessage(ROUTE[instr].Layer[i]);
+ }
+}
+
+void TrackNotesOff(int i)
+{ //note-off for the last notes of all note-columns of track 'i'
+ int j;
+ for (j=0;j<PtnNoteColumns;j++) if (prevnote[i][j]>0) { CurrentColumn=j; NoteOff(PLAYEDINS[i],prevnote[i][j],0); }
+ CurrentColumn=0;
+}
+
+void AllNotesOff(unsigned char instr)
+{
+ LayerMessage(instr,0xB0,0x7B,0);
+}
+
+void SelectIns(unsigned char instr)
+{ //every layer gets its own patch
+ int i, layer;
+ for (i=0;i<ROUTE[instr].Layers;i++)
+ {
+  layer=ROUTE[instr].Layer[i];
+  if (!INSTRUMENT[layer][0] && !INSTRUMENT[layer][1] && !INSTRUMENT[layer][2]) continue; //avoid empty instrument (can cause loopback) //if (instr<1 || instr>0x80) return;
+  PlayerMessage.push_back(0xC0+ROUTE[layer].Channel); PlayerMessage.push_back(INSTRUMENT[layer][INST_PATCH]-1); //instruments in MIDItrk start from 1
+  CarefulMessage(layer);
+ }
+}
+
+void SetVolume(unsigned char instr, unsigned char volume)
+{
+ LayerMessage(instr,0xB0,0x07,volume);
+}
+
+void SetAfterTouch(unsigned char instr, unsigned char aftertouch)
+{
+ LayerMessage(instr,0xD0,aftertouch,-1);
+}
+
+void SetPitchWheel(unsigned char instr, unsigned int pitchwheel) //pitchwheel walue: 0000...2000(middle)...3FFF
+{
+ LayerMessage(instr,0xE0,pitchwheel&0x1F,pitchwheel/0x80);
+}
+
+void UniqueCC(unsigned char instr, unsigned char CCnum, unsigned char value)
+{
+ LayerMessage(instr,0xB0,CCnum,value);
+}
+
+void SetPortamento(unsigned char instr, unsigned char time)
+{
+ int i, layer;
+ for (i=0;i<ROUTE[instr].Layers;i++)
+ {
+  layer=ROUTE[instr].Layer[i];
+  PlayerMessage.push_back(0xB0+ROUTE[layer].Channel); PlayerMessage.push_back(0x05); PlayerMessage.push_back(time);
+  PlayerMessage.push_back(0xB0+ROUTE[layer].Channel); PlayerMessage.push_back(65); PlayerMessage.push_back((time)?64:63);
+  CarefulMessage(layer);
+ }
+}
+
+unsigned char SmallCCFXlist[16]={
+                  0x00, //0 select bank
+                  0x02, //1 breath controller
+                  0x04, //2 foot controller
+                  0x05, //3 portamento-time 
+                  0x08, //4 balance
+                  0x0a, //5 panning
+                  0x0b, //6 expression
+                  0x0c, //7 effect1
+                  0x0d, //8 effect2
+                  0x10, //9 general purpose 1
+                  0x11, //A general purpose 2
+                  0x44, //B switches: Damper Pedal(0x40), Portamento On/Off (0x41), Sustenuto On/Off (0x42), Soft Pedal On/Off (0x43), Legato footswitch (0x44), Hold 2 (0x45)
+                  0x5b, //C Effect1 Reverb level
+                  0x5c, //D Effect2 Tremolo level
+                  0x5d, //E Effect3 Chorus level
+                  0x5e};//F Effect4 Detune level
+
+void SmallCCFX(unsigned char instr, unsigned char CCfx)
+{
+ LayerMessage(instr,0xB0,SmallCCFXlist[CCfx/16],(CCfx&0xF)*8);
+}
+
+void KUSS()
+{ //note-off for exactly the notes left sounding, in one burst (no all-notes-off flood to every instrument's channel)
+ int port, channel, word, bit; unsigned int keys; std::vector<unsigned char> message(3);
+ SDL_LockMutex(OutputLock);
+ PortDelayClear();
+ for (port=0;port<PortAmount;port++) for (channel=0;channel<16;channel++) for (word=0;word<4;word++)
+ {
+  keys=SOUNDING[port][channel][word];
+  for (bit=0;keys;bit++,keys>>=1) if (keys&1)
+  {
+   message[0]=0x80+channel; message[1]=word*32+bit; message[2]=0;
+   PortWrite(port,&message); NotesKilled++;
+  }
+ }
+ SDL_UnlockMutex(OutputLock);
+}
+
+void ResetPlayerState(bool PlayFromBeginning)
+{ //sets the player-variables to the start of the tune (or to the F2 play-markers)
+ int i;
+ for (i=0;i<TrackAmount;i++)
+ {
+  SEQCNT[i]=(PlayFromBeginning)? 0 : F2playMarker[i];
+  PATTCNT[i]=0; Vibrato[i]=false; SlideSpeed[i]=SlideCnt[i]=0;
+  TEMPO[i]=deftempo; SPDCNT[i]=TEMPO[i]; DELAYCNT[i]=-1;
+  BPM[i]=0; ROWSPERBEAT[i]=defrowsperbeat; ROWLENGTH[i]=ROWCLOCK[i]=0;
+  PLAYEDINS[i]=DefaultIns[i]; memset(prevnote[i],0,PtnNoteColumns); //notes are stopped by KUSS, no note-off for a note of an earlier playback
+  EndOfTrack[i]=false;
+ }
+ TuneBPM=0; PLAYFRAME=0; TickActive=0; CLOCKPOS=0;
+ memset(TRACKWAIT,0,sizeof(TRACKWAIT)); TracksPlaying=(1<<TrackAmount)-1;
+}
+
+//------------------------------ LIVE PATTERN-LAUNCH ------------------------------------------
+//Shift+L (or a note of the launch-channel) queues a pattern (orderlist-position) for a track, the player takes it in
+//the frame where the track's next HiLight-row (or the end of its pattern) is due. The ones queued after it follow at
+//the end of the pattern it launched. Only the live player launches: compiling, export & preview play the orderlists.
+bool LaunchLive() { return !CompileMode && !ExportMode && !Previewing; }
+
+void LaunchQueue(int i, unsigned char type, unsigned char value)
+{ //a launch waits for its row on track 'i'
+ Launch launch;
+ unsigned char Notes[TrackAmount][PtnNoteColumns];
+ if (i<0 || i>=TrackAmount || LAUNCHQUEUE[i].size()>=LAUNCH_QUEUE) return;
+ if (type==LAUNCH_PATTERN && value>=MaxPtnAmount) return;
+ if (type==LAUNCH_SEQPOS && (value>=MaxSeqLength || SEQUENCE[i][value]>=ORDERLIST_FX_MIN)) return;
+ if (TimelinePlaying)
+ { //the compiled timeline doesn't know the launch: the interpreter continues from the playing frame
+  memcpy(Notes,prevnote,sizeof(Notes)); ScanTo(PLAYFRAME); memcpy(prevnote,Notes,sizeof(Notes));
+  TimelinePlaying=false;
+ }
+ launch.Type=type; launch.Value=value; launch.AtEnd=(LaunchAtEnd || LAUNCHQUEUE[i].size());
+ LAUNCHQUEUE[i].push_back(launch);
+}
+
+void LaunchClear()
+{ //the orderlists play again, waiting launches are dropped
+ int i;
+ for (i=0;i<TrackAmount;i++) { LAUNCHQUEUE[i].clear(); LAUNCHED[i]=0xFF; }
+}
+
+bool LaunchBoundary(int i, bool atend)
+{ //the row of track 'i' about to be played is where a launch can come
+ return (atend)? PATTCNT[i]==0 : PATTCNT[i]%HiLight==0;
+}
+
+void LaunchRow(int i)
+{ //the first waiting launch takes over the row if it's at its boundary
+ Launch launch=LAUNCHQUEUE[i][0];
+ if (!LaunchBoundary(i,launch.AtEnd)) return;
+ LAUNCHQUEUE[i].erase(LAUNCHQUEUE[i].begin());
+ if (launch.Type==LAUNCH_PATTERN) LAUNCHED[i]=launch.Value;
+ else { LAUNCHED[i]=0xFF; SEQCNT[i]=launch.Value; }
+ PATTCNT[i]=0;
+ if (FollowPlay) selpatt[i]=(LAUNCHED[i]!=0xFF)? LAUNCHED[i] : SEQUENCE[i][SEQCNT[i]];
+}
+
+bool RowComing(int i)
+{ //the next row of track 'i' is due in this frame (as RowDue will tell, without counting)
+ if (TRACKWAIT[i] || DELAYCNT[i]>0) return false;
+ if (DELAYCNT[i]==0) return true;
+ if (!BPM[i]) return SPDCNT[i]>TEMPO[i];
+ return ROWCLOCK[i]+ROWCLOCK_FRAME>=ROWLENGTH[i];
+}
+
+void LaunchRevive()
+{ //an ended track with a launch starts with the row of the first playing track (at once if none plays)
+ int i, lead=-1;
+ for (i=0;i<TrackAmount && lead<0;i++) if (TracksPlaying&(1<<i)) lead=i;
+ for (i=0;i<TrackAmount;i++) if (!(TracksPlaying&(1<<i)) && LAUNCHQUEUE[i].size())
+ {
+  if (lead>=0 && (!RowComing(lead) || !LaunchBoundary(lead,LAUNCHQUEUE[i][0].AtEnd))) continue;
+  if (lead>=0)
+  { //the same row-timing as the leading track: its row is due in this frame
+   TEMPO[i]=TEMPO[lead]; SPDCNT[i]=SPDCNT[lead]; BPM[i]=BPM[lead]; ROWSPERBEAT[i]=ROWSPERBEAT[lead];
+   ROWLENGTH[i]=ROWLENGTH[lead]; ROWCLOCK[i]=ROWCLOCK[lead]; DELAYCNT[i]=DELAYCNT[lead];
+  }
+  else { BPM[i]=0; SPDCNT[i]=TEMPO[i]+1; DELAYCNT[i]=-1; }
+  PATTCNT[i]=0; TRACKWAIT[i]=0; EndOfTrack[i]=false; TracksPlaying|=1<<i;
+ }
+}
+
+void LaunchInput()
+{ //launch-notes of the MIDI-input
+ unsigned short launch;
+ SDL_LockMutex(InputLock);
+ while (LaunchInboxOut!=LaunchInboxIn)
+ {
+  launch=LaunchInbox[LaunchInboxOut%LAUNCH_INBOX]; LaunchInboxOut++;
+  LaunchQueue(launch/256,LAUNCH_PATTERN,launch%256);
+ }
+ SDL_UnlockMutex(InputLock);
+}
+
+void FindPlayingTracks()
+{ //after EndOfTrack[] was set from outside the player (snapshot, timeline-seek)
+ int i;
+ TracksPlaying=0; for (i=0;i<TrackAmount;i++) if (!EndOfTrack[i]) TracksPlaying|=1<<i;
+ memset(TRACKWAIT,0,sizeof(TRACKWAIT));
+}
+
+void InitRoutine(bool PlayFromBeginning)
+{
+ int i;
+ if (ExportMode==false) { KUSS(); LaunchClear(); }
+ TimelineStop(); ResetPlayerState(PlayFromBeginning); ShaperReset((ExportMode)? FILTER_EXPORT : FILTER_LIVE);
+ Scrubbing=false; PlayedFromStart=PlayFromBeginning;
+ if (!PlayFromBeginning) SeekMarkers(); //restores instruments, tempo & controllers of the play-marks
+ for (i=0;i<TrackAmount;i++)
+ {
+  if (PlayFromBeginning) { SelectIns(PLAYEDINS[i]); SetVolume(PLAYEDINS[i],0x7F); }
+  //UniqueCC(PLAYEDINS[i],01,0x00); SetPitchWheel(PLAYEDINS[i],0x2000); //reset by new notes
+  DisPattCnt(i);
+  
+  if (FollowPlay) { selpatt[i]=SEQUENCE[i][SEQCNT[i]]; }
+ }
+ if (FollowPlay) pattpos=0; DisPattData();
+}
+
+
+//The row-timing (tempo, BPM row-clock, 9xx delays, pattern-rows) works on a TuneTiming, so the player and the
+//length-measuring of the song-library (MeasureTune) step the tracks the same way.
+void RowLength(TuneTiming &t, int i)
+{ //BPM-tempo: frames of a row in fixed-point (3000 frames in a minute)
+ t.RowLength[i]=(3000*ROWCLOCK_FRAME)/(t.Bpm[i]*t.RowsPerBeat[i]);
+}
+
+void TimingTempo(TuneTiming &t, int i, int value)
+{ //Fxx: frame-tempo for all tracks (00..7F) or track 'i' (80..FF); 0xx (TEMPO_BPM+xx): BPM for all tracks (10..FF) or rows-per-beat of track 'i' (01..0F)
+ int j;
+ if (value<TEMPO_BPM)
+ {
+  if (value<0x80) { for(j=0;j<TrackAmount;j++) { t.Tempo[j]=value; t.Bpm[j]=0; } *t.TuneBpm=0; }
+  else { t.Tempo[i]=value&0x7f; t.Bpm[i]=0; }
+ }
+ else if ((value&0xFF)<0x10) { t.RowsPerBeat[i]=value&0xF; if (t.Bpm[i]) RowLength(t,i); }
+ else
+ {
+  *t.TuneBpm=value&0xFF;
+  for (j=0;j<TrackAmount;j++)
+  {
+   if (!t.Bpm[j]) t.RowClock[j]=t.SpdCnt[j]*ROWCLOCK_FRAME; //frames since the last row are counted in
+   t.Bpm[j]=*t.TuneBpm; RowLength(t,j);
+  }
+ }
+}
+
+void SetTempo(int i, int value)
+{
+ memset(TRACKWAIT,0,sizeof(TRACKWAIT)); //the row-countdowns are recalculated at the next rows
+ TimingTempo(PlayerTiming,i,value);
+}
+
+int RowTempo(const unsigned char *row)
+{ //the tempo-value of a row for SetTempo() (0xx, Fxx), -1 if none
+ if ((row[PTN_FX]&0xF)==0x0 && row[PTN_FXVALUE]) return TEMPO_BPM+row[PTN_FXVALUE];
+ if ((row[PTN_FX]&0xF)==0xF) return row[PTN_FXVALUE];
+ return -1;
+}
+
+bool RowDelayed(TuneTiming &t, int i)
+{ //a frame of a 9xx-delayed row passes (the BPM row-clock runs on)
+ if (t.DelayCnt[i]<=0) return false;
+ t.DelayCnt[i]--; if (t.Bpm[i]) t.RowClock[i]+=ROWCLOCK_FRAME;
+ return true;
+}
+
+bool RowDue(TuneTiming &t, int i)
+{ //frame-tempo: a row lasts TEMPO+2 frames; BPM-tempo: fractional row-clock, the remainder is kept for the next row so tracks don't drift
+ if (!t.Bpm[i]) { if (t.SpdCnt[i]<=t.Tempo[i]) { t.SpdCnt[i]++; return false; } return true; }
+ t.RowClock[i]+=ROWCLOCK_FRAME;
+ if (t.DelayCnt[i]==0) return true; //the delayed row (9xx) was already counted
+ if (t.RowClock[i]<t.RowLength[i]) { t.SpdCnt[i]++; return false; }
+ t.RowClock[i]-=t.RowLength[i]; return true;
+}
+
+bool RowStart(TuneTiming &t, int i, const unsigned char *row)
+{ //the speed-counter of a due row, false if its 9xx delays it
+ if (t.DelayCnt[i]==-1)
+ {
+  if ((row[PTN_FX]&0xf)==0x9 && row[PTN_FXVALUE]<TICKFX_MIN) { t.DelayCnt[i]=row[PTN_FXVALUE]; return false; } //delay note by given frames
+  t.SpdCnt[i]=0;
+ }
+ else if (t.DelayCnt[i]==0) { t.DelayCnt[i]=-1; if (row[PTN_FXVALUE]<t.Tempo[i]) t.SpdCnt[i]=row[PTN_FXVALUE]+1; } //but regain tempo afterwards, if possible
+ return true;
+}
+
+bool RowNext(TuneTiming &t, int i, int length)
+{ //the next row of the pattern, true at its end (the pattern-counter starts again)
+ if (t.PattCnt[i]<length-1) { t.PattCnt[i]++; return false; }
+ t.PattCnt[i]=0; return true;
+}
+
+void ContiPlay(int i)
+{
+ if (SlideSpeed[i]!=0) 
+ { 
+  SlideCnt[i] += SlideSpeed[i]*16; 
+  if (CompileMode) TimelineRamp(i,SlideCnt[i],SlideSpeed[i]*16); //stored as a single pitch-ramp event
+  else SetPitchWheel(PLAYEDINS[i],0x2000+SlideCnt[i]);
+ }
+}
+
+void AdvanceRow(int i, int chptn)
+{ //step track 'i' to the next pattern-row, or to the next orderlist-position at the end of the pattern
+ if (RowNext(PlayerTiming,i,PATTLENG[chptn]))
+ {
+  if (PlayMode!=2 && (LAUNCHED[i]==0xFF || !LaunchLive())) //check if pattern-play mode (or a launched pattern looping)
+  {
+   SEQCNT[i]++; 
+   if (SEQUENCE[i][SEQCNT[i]]==ORDERLIST_FX_JUMP) 
+   {
+    if (ExportMode) EndOfTrack[i]=true;
+    else 
+    {
+     if (CompileMode) { TimelineSeqEntered(i,SEQCNT[i]); TimelineMark(i,TLEV_JUMP,SEQUENCE[i][SEQCNT[i]+1]); }
+     SEQCNT[i]=SEQUENCE[i][SEQCNT[i]+1];
+    }
+   }
+   else if (SEQUENCE[i][SEQCNT[i]]==ORDERLIST_FX_END) EndOfTrack[i]=true;
+   if (CompileMode) { TimelineSeqEntered(i,SEQCNT[i]); if (EndOfTrack[i]) TimelineMark(i,TLEV_END,SEQCNT[i]); }
+   if (EndOfTrack[i]) TracksPlaying&=~(1<<i);
+   if (FollowPlay && !EndOfTrack[i]) 
+   { 
+    if (SEQUENCE[i][SEQCNT[i]]<ORDERLIST_FX_MIN) 
+    {
+     selpatt[i]=SEQUENCE[i][SEQCNT[i]]; pattpos=0;
+    }
+   }
+  }
+  else if (FollowPlay) pattpos=0;
+  if (!CompileMode) DispSeqCnt(i);
+ }
+}
+
+void PlayNotes(int i, unsigned char *notes, unsigned char velo)
+{ //the notes of a row on track 'i', every note-column holds its own note, so a track can play chords
+ int j;
+ bool NewNote=false;
+ for (j=0;j<PtnNoteColumns;j++)
+ {
+  if (notes[j]==0) continue;
+  CurrentColumn=j;
+  if (notes[j]<NOTE_MAX)
+  { 
+   if (prevnote[i][j]>0) NoteOff(PLAYEDINS[i],prevnote[i][j],0x0); 
+   if (mutesolo[i] || CompileMode) { NoteOn(PLAYEDINS[i],notes[j],velo); prevnote[i][j]=notes[j]; }
+   NewNote=true;
+  }
+  else if (notes[j]==GATEOFF_NOTEFX && prevnote[i][j]>0) NoteOff(PLAYEDINS[i],prevnote[i][j],0x0); 
+  else if ((mutesolo[i] || CompileMode) && notes[j]==GATEON_NOTEFX && prevnote[i][j]>0) NoteOn(PLAYEDINS[i],prevnote[i][j],velo); 
+ }
+ CurrentColumn=0;
+ if (NewNote)
+ {
+  if (Vibrato[i]) {UniqueCC(PLAYEDINS[i],01,0x00); Vibrato[i]=false;} //new note resets Modulation wheel (Vibrato Amplitude)
+  if (SlideSpeed[i]!=0 || SlideCnt[i]!=0) {SetPitchWheel(PLAYEDINS[i],0x2000); SlideSpeed[i]=SlideCnt[i]=0;}
+ }
+}
+
+//tick-effect handlers: called in the frames after the row started (fx.Count), false means the effect is over
+bool TickRetrigger(int i, TickEffect &fx)
+{
+ int j, velo;
+ if (fx.Count%fx.Frames) return true;
+ velo=fx.Velo+fx.Ramp; fx.Velo=(velo<1)? 1 : (velo>0x7F)? 0x7F : velo;
+ for (j=0;j<PtnNoteColumns;j++) if (prevnote[i][j]>0)
+ {
+  CurrentColumn=j; NoteOff(PLAYEDINS[i],prevnote[i][j],0x0);
+  if (mutesolo[i] || CompileMode) NoteOn(PLAYEDINS[i],prevnote[i][j],fx.Velo);
+ }
+ CurrentColumn=0;
+ return true;
+}
+
+bool TickCut(int i, TickEffect &fx)
+{
+ if (fx.Count<fx.Frames) return true;
+ TrackNotesOff(i); return false;
+}
+
+bool TickDelay(int i, TickEffect &fx)
+{
+ if (fx.Count<fx.Frames) return true;
+ PlayNotes(i,fx.Notes,fx.Velo); return false;
+}
+
+bool TickArpeggio(int i, TickEffect &fx)
+{ //the chord-notes take turns in the 1st note-column
+ if (fx.Amount<2) return false;
+ if (fx.Count%fx.Frames) return true;
+ fx.Step=(fx.Step+1)%fx.Amount;
+ if (prevnote[i][0]>0) NoteOff(PLAYEDINS[i],prevnote[i][0],0x0);
+ if (mutesolo[i] || CompileMode) { NoteOn(PLAYEDINS[i],fx.Notes[fx.Step],fx.Velo); prevnote[i][0]=fx.Notes[fx.Step]; }
+ return true;
+}
+
+typedef bool (*TickHandler)(int i, TickEffect &fx);
+TickHandler TickHandlers[8]={TickRetrigger,TickRetrigger,TickRetrigger,TickCut,TickDelay,TickArpeggio,NULL,NULL}; //by TICK_... (9Ey/9Fy: none)
+
+void TickStart(int i, unsigned char *notes, unsigned char velo, unsigned char fxvalue)
+{ //9xy (x=8..F) on a row of track 'i': the notes given to PlayNotes() are changed for delay/arpeggio
+ TickEffect &fx=TICKFX[i];
+ int j;
+ fx.Handler=(fxvalue/16)&7; if (TickHandlers[fx.Handler]==NULL) return;
+ fx.Frames=(fxvalue&0xF)? fxvalue&0xF : 1; fx.Count=fx.Step=fx.Amount=0; fx.Velo=velo;
+ fx.Ramp=(fx.Handler==TICK_FADEOUT)? -8 : (fx.Handler==TICK_FADEIN)? 8 : 0;
+ if (fx.Handler==TICK_DELAY) { memcpy(fx.Notes,notes,PtnNoteColumns); memset(notes,0,PtnNoteColumns); }
+ else if (fx.Handler==TICK_ARPEGGIO)
+ {
+  for (j=0;j<PtnNoteColumns;j++) if (notes[j]>0 && notes[j]<NOTE_MAX) fx.Notes[fx.Amount++]=notes[j];
+  memset(notes,0,PtnNoteColumns); if (fx.Amount) notes[0]=fx.Notes[0]; //the arpeggio starts in the row's frame
+ }
+ TickActive|=1<<i;
+}
+
+void TickFrame()
+{ //one pass for all tracks with a running tick-effect, the handler is taken from the table (adding effects costs no time here)
+ unsigned int active;
+ int i;
+ for (active=TickActive,i=0; active; active>>=1,i++) if (active&1)
+ {
+  TickEffect &fx=TICKFX[i];
+  CurrentTrack=i;
+  if (fx.Count && !TickHandlers[fx.Handler](i,fx)) TickActive&=~(1<<i); //the row's own frame was played by PlayTrack
+  fx.Count++;
+ }
+}
+
+void PlayTrack(int i)
+{ //process one 20ms frame of track 'i'
+ int j,chptn,tempo;
+ static unsigned char EmptyRow[PtnColumns];
+ unsigned char notes[PtnNoteColumns],velo,fxdata,fxvalue,*row;
+ if (EndOfTrack[i]) return;
+ if (RowDelayed(PlayerTiming,i)) return;
+ if (RowDue(PlayerTiming,i))
+ {
+  if (LAUNCHQUEUE[i].size() && LaunchLive()) LaunchRow(i); //a launch waiting for this row
+  if (LAUNCHED[i]!=0xFF && LaunchLive()) chptn=LAUNCHED[i];
+  else if (PlayMode!=2) chptn=SEQUENCE[i][SEQCNT[i]]; else chptn=selpatt[i];
+  row=(chptn<MaxPtnAmount)? PATTERNS[chptn][PATTCNT[i]] : EmptyRow; //the whole row is read from one place (an orderlist starting with FF has none)
+  fxdata=row[PTN_FX]; fxvalue=row[PTN_FXVALUE];
+  if (!RowStart(PlayerTiming,i,row)) return; //9xx: the row comes later
+
+
+  TickActive&=~(1<<i); //a tick-effect lasts till the end of its row
+  for (j=0;j<PtnNoteColumns;j++) notes[j]=row[PtnNoteColumn[j]];
+  velo=((fxdata/16-1)&0xF)*8;
+
+  switch (fxdata&0xF) 
+  {
+   case 0x5: UniqueCC(PLAYEDINS[i],73,fxvalue); //Attack
+          break;
+   case 0x6: UniqueCC(PLAYEDINS[i],75,fxvalue); //Decay
+          break;
+   case 0x7: UniqueCC(PLAYEDINS[i],72,fxvalue); //Release
+          break;
+   case 0x8: UniqueCC(PLAYEDINS[i],76,fxvalue); //Vibrato Rate
+          break;
+   
+   case 0xA: SetVolume(PLAYEDINS[i],fxvalue);
+          break;
+   case 0xB: SmallCCFX(PLAYEDINS[i],fxvalue);
+          break;
+   case 0xC: PLAYEDINS[i]=fxvalue; if (CompileMode) { TimelineMark(i,TLEV_INSTR,fxvalue); TimelineInstrUsed(fxvalue); }
+             SelectIns(fxvalue); if (!CompileMode) DispTrkInfo();
+          break;
+   case 0xD: SetAfterTouch(PLAYEDINS[i],fxvalue);
+          break;
+   case 0xE: SetPitchWheel(PLAYEDINS[i],fxvalue*64); SlideSpeed[i]=SlideCnt[i]=0;
+          break;
+   case 0x0: case 0xF: if ((tempo=RowTempo(row))>=0) { SetTempo(i,tempo); if (CompileMode) TimelineMark(i,TLEV_TEMPO,tempo); }
+          break;
+   case 0x9: if (fxvalue>=TICKFX_MIN) TickStart(i,notes,velo,fxvalue);
+          break;
+   default: break;
+  }
+  
+  PlayNotes(i,notes,velo);
+  
+  switch (fxdata&0xF) //After-effects
+  {
+   case 0x1: SlideSpeed[i]=fxvalue;
+          break;
+   case 0x2: SlideSpeed[i]=fxvalue*-1;
+          break;
+   case 0x3: SetPortamento(PLAYEDINS[i],fxvalue);
+          break;
+   case 0x4: UniqueCC(PLAYEDINS[i],01,fxvalue); Vibrato[i]=true; //Modulation wheel (Vibrato Amplitude)
+          break;
+   default: break;
+  }
+
+  if (CompileMode) TimelineMark(i,TLEV_ROW,SEQCNT[i]);
+  else if (!FollowPlay) DisPattCnt(i);
+
+  AdvanceRow(i,chptn);
+  if (DELAYCNT[i]==-1) //frames RowDue() would only count till the next row
+  {
+   if (BPM[i]) TRACKWAIT[i]=(ROWCLOCK[i]<ROWLENGTH[i])? (ROWLENGTH[i]-ROWCLOCK[i]-1)/ROWCLOCK_FRAME : 0;
+   else TRACKWAIT[i]=(SPDCNT[i]<=TEMPO[i])? TEMPO[i]-SPDCNT[i]+1 : 0;
+  }
+
+ } //SPDCNT
+ ContiPlay(i);
+}
+
+void PlayFrame()
+{ //one 20ms frame of the interpreting player
+ int i;
+ if (TracksPlaying!=(1<<TrackAmount)-1 && LaunchLive()) LaunchRevive(); //ended tracks with launches waiting
+ for (i=TrackAmount-1;i>=0;i--) if (TracksPlaying&(1<<i)) //i counts backwards: 1st channel has the priority for common effects like tempo-change
+ {
+  CurrentTrack=i;
+  if (TRACKWAIT[i]) { TRACKWAIT[i]--; SPDCNT[i]++; if (BPM[i]) ROWCLOCK[i]+=ROWCLOCK_FRAME; ContiPlay(i); } //no row due: only counting
+  else PlayTrack(i);
+ }
+ TickFrame();
+ ClockFrame(); MtcFrame(); PLAYFRAME++;
+}
+
+void FrameEnd()
+{ //end-of-tune check and follow-play scrolling after every frame
+ bool ended=EndOfTune;
+ EndOfTune=(TracksPlaying==0);
+ if (EndOfTune && !ended && !CompileMode && !ExportMode && !(SetlistPos>=0 && NextLoaded>=0)) ClockTransport(MIDI_STOP); //the clock runs on into the next tune of a setlist
+ if (EndOfTune && FollowPlay) {FollowPlay=false; DisPattData();}
+ 
+ if (FollowPlay && SPDCNT[WinPos1[0]+TrkPos]==0 && !EndOfTune) 
+ {
+  if (PATTCNT[WinPos1[0]+TrkPos] >= PattDimY/2 && PATTCNT[WinPos1[0]+TrkPos]-1 < PATTLENG[selpatt[WinPos1[0]+TrkPos]]-PattDimY/2) 
+  {
+   pattpos=PATTCNT[WinPos1[0]+TrkPos]-PattDimY/2; WinPos2[0]=PattDimY/2-1;
+  }
+  else 
+  { 
+   if (PATTCNT[WinPos1[0]+TrkPos] < PattDimY/2) pattpos=0; 
+   else pattpos=PATTLENG[selpatt[WinPos1[0]+TrkPos]]-PattDimY;
+   WinPos2[0]=(PATTCNT[WinPos1[0]+TrkPos]-pattpos)-1;
+  }
+  if (WinPos2[0]<0) WinPos2[0]=0; //safety check
+  if (WinPos2[0]>=PattDimY) WinPos2[0]=PattDimY-1; //safety check
+  DisPattData();
+ }
+}
+
+void PlayRoutine()
+{
+ Scheduling=!ExportMode;
+ if (fastfwd) Scrub(fastfwd*ffwdspeed);
+ else
+ {
+  if (Scrubbing) ScrubEnd();
+  SetlistFrame(); //the next tune of the setlist takes over at its boundary
+  if (TimelinePlaying && PlayMode!=2) TimelineFrame(); else PlayFrame();
+  FrameEnd(); SetlistArm();
+ }
+ Scheduling=false;
+ if (ExportMode) ShaperFrame(FILTER_EXPORT);
+ else { ScheduleFlush(); ShaperFrame(FILTER_LIVE); } //pitch-wheel streams get the port-budget left over
+}
+
+//---------------------------------------------------------------------------------------------
+//------------------------------ COMPILED EVENT TIMELINE --------------------------------------
+//The player runs ahead in CompileMode and its MIDI-output is stored per track with frame-stamps.
+//F1-playback (if switched on by Alt+F1) and MIDI-export then only step cursors through the events.
+void SaveSnapshot(PlayerSnapshot &state)
+{
+ int i;
+ for (i=0;i<TrackAmount;i++)
+ {
+  state.PattCnt[i]=PATTCNT[i]; state.SeqCnt[i]=SEQCNT[i]; state.SpdCnt[i]=SPDCNT[i]; state.Tempo[i]=TEMPO[i]; state.DelayCnt[i]=DELAYCNT[i];
+  state.SlideSpeed[i]=SlideSpeed[i]; state.SlideCnt[i]=SlideCnt[i]; state.PlayedIns[i]=PLAYEDINS[i]; memcpy(state.PrevNote[i],prevnote[i],PtnNoteColumns);
+  state.EndOfTrack[i]=EndOfTrack[i]; state.Vibrato[i]=Vibrato[i]; state.Looped[i]=Looped[i]; state.Events[i]=TIMELINE[i].size();
+  state.Bpm[i]=BPM[i]; state.RowsPerBeat[i]=ROWSPERBEAT[i]; state.RowLength[i]=ROWLENGTH[i]; state.RowClock[i]=ROWCLOCK[i];
+ }
+ state.TuneBpm=TuneBPM; state.Frame=PLAYFRAME; memcpy(state.Channels,CHANNELS,sizeof(CHANNELS));
+ memcpy(state.TickFx,TICKFX,sizeof(TICKFX)); state.TickActive=TickActive; state.ClockPos=CLOCKPOS;
+ memcpy(state.TrackWait,TRACKWAIT,sizeof(TRACKWAIT));
+}
+
+void LoadSnapshot(PlayerSnapshot &state)
+{
+ int i;
+ for (i=0;i<TrackAmount;i++)
+ {
+  PATTCNT[i]=state.PattCnt[i]; SEQCNT[i]=state.SeqCnt[i]; SPDCNT[i]=state.SpdCnt[i]; TEMPO[i]=state.Tempo[i]; DELAYCNT[i]=state.DelayCnt[i];
+  SlideSpeed[i]=state.SlideSpeed[i]; SlideCnt[i]=state.SlideCnt[i]; PLAYEDINS[i]=state.PlayedIns[i]; memcpy(prevnote[i],state.PrevNote[i],PtnNoteColumns);
+  EndOfTrack[i]=state.EndOfTrack[i]; Vibrato[i]=state.Vibrato[i]; Looped[i]=state.Looped[i];
+  BPM[i]=state.Bpm[i]; ROWSPERBEAT[i]=state.RowsPerBeat[i]; ROWLENGTH[i]=state.RowLength[i]; ROWCLOCK[i]=state.RowClock[i];
+ }
+ TuneBPM=state.TuneBpm; PLAYFRAME=state.Frame; memcpy(CHANNELS,state.Channels,sizeof(CHANNELS));
+ memcpy(TICKFX,state.TickFx,sizeof(TICKFX)); TickActive=state.TickActive; CLOCKPOS=state.ClockPos;
+ FindPlayingTracks(); memcpy(TRACKWAIT,state.TrackWait,sizeof(TRACKWAIT)); //the countdowns go on (a compile-batch returns to the live state every frame)
+}
+
+void TimelineRecord(unsigned char instr)
+{ //store the actual PlayerMessage as an event of the track being compiled
+ TimelineEvent event;
+ unsigned int i;
+ event.Frame=PLAYFRAME; event.Instr=instr; event.Value=event.Step=event.Count=0;
+ event.Size=(PlayerMessage.size()<=6)? PlayerMessage.size() : 6;
+ for (i=0;i<event.Size;i++) event.Data[i]=PlayerMessage.at(i);
+ if (event.Size==3 && (event.Data[0]&0xF0)==0x90) { event.Type=TLEV_NOTEON; event.Value=CurrentColumn; }
+ else if (event.Size==3 && (event.Data[0]&0xF0)==0x80) { event.Type=TLEV_NOTEOFF; event.Value=CurrentColumn; }
+ else event.Type=TLEV_MIDI;
+ TIMELINE[CurrentTrack].push_back(event);
+ PlayerMessage.clear();
+}
+
+void TimelineMark(int i, unsigned char type, int value)
+{ //store a non-MIDI event (row, instrument, tempo, jump, end) of track 'i'
+ TimelineEvent event;
+ if (ScanMode) return;
+ event.Frame=PLAYFRAME; event.Type=type; event.Instr=PLAYEDINS[i]; event.Size=0;
+ event.Value=value; event.Step=PATTCNT[i]; event.Count=0;
+ TIMELINE[i].push_back(event);
+ if (type==TLEV_JUMP) { Looped[i]=true; if (LOOPTICK[i]==TIMELINE_UNKNOWN) { LOOPTICK[i]=PLAYFRAME; LOOPPOS[i]=value; } }
+ if (type==TLEV_END && ENDTICK[i]==TIMELINE_UNKNOWN) ENDTICK[i]=PLAYFRAME;
+}
+
+void TimelineRamp(int i, int value, int step)
+{ //a frame of pitch-slide: lengthens the previous ramp if nothing happened in between
+ std::vector<TimelineEvent> &events=TIMELINE[i];
+ bool Scanning=ScanMode;
+ ScanMode=true; SetPitchWheel(PLAYEDINS[i],0x2000+value); ScanMode=Scanning; //only updates the channel-state
+ if (ScanMode) return;
+ if (!events.empty())
+ {
+  TimelineEvent &last=events.back();
+  if (last.Type==TLEV_RAMP && last.Instr==PLAYEDINS[i] && last.Step==step && last.Frame+last.Count==PLAYFRAME && last.Value+last.Step*last.Count==value) 
+  { last.Count++; return; }
+ }
+ TimelineEvent event;
+ event.Frame=PLAYFRAME; event.Type=TLEV_RAMP; event.Instr=PLAYEDINS[i]; event.Size=0;
+ event.Value=value; event.Step=step; event.Count=1;
+ events.push_back(event);
+}
+
+void TimelineInstrUsed(unsigned char ins)
+{ //note the first frame an instrument is played by a track (edits of it invalidate the timeline from this frame)
+ if (ScanMode) return;
+ if (INSTTICK[ins]==TIMELINE_UNKNOWN) INSTTICK[ins]=PLAYFRAME;
+}
+
+void TimelineSeqEntered(int i, int pos)
+{ //note the first frame of an orderlist-position and its pattern (edits there invalidate the timeline from this frame) and the timing-index
+ SeqEntry entry;
+ if (ScanMode) return;
+ if (SEQTICK[i][pos]==TIMELINE_UNKNOWN) SEQTICK[i][pos]=PLAYFRAME;
+ if (SEQUENCE[i][pos]<ORDERLIST_FX_MIN)
+ {
+  if (PTNTICK[SEQUENCE[i][pos]]==TIMELINE_UNKNOWN) PTNTICK[SEQUENCE[i][pos]]=PLAYFRAME;
+  entry.Frame=PLAYFRAME; entry.Pos=pos; SEQINDEX[i].push_back(entry);
+ }
+}
+
+unsigned int EventSearch(int i, unsigned int frame)
+{ //index of the first event of track 'i' at or after 'frame' (binary search)
+ unsigned int low=0, high=TIMELINE[i].size(), mid;
+ while (low<high) { mid=(low+high)/2; if (TIMELINE[i][mid].Frame<frame) low=mid+1; else high=mid; }
+ return low;
+}
+
+unsigned int IndexSearch(int i, unsigned int frame)
+{ //index of the first orderlist-entry of track 'i' at or after 'frame' in the timing-index (binary search)
+ unsigned int low=0, high=SEQINDEX[i].size(), mid;
+ while (low<high) { mid=(low+high)/2; if (SEQINDEX[i][mid].Frame<frame) low=mid+1; else high=mid; }
+ return low;
+}
+
+int PositionAt(int i, unsigned int frame)
+{ //orderlist-position played by track 'i' at 'frame', -1 if not compiled that far or the track ended
+ unsigned int entry=IndexSearch(i,frame+1);
+ if (frame>=TimelineState.Frame || entry==0 || (ENDTICK[i]!=TIMELINE_UNKNOWN && frame>ENDTICK[i])) return -1;
+ return SEQINDEX[i][entry-1].Pos;
+}
+
+unsigned int PositionFrame(int i, int pos)
+{ //frame where track 'i' first reaches orderlist-position 'pos' (TIMELINE_UNKNOWN if not reached yet)
+ return SEQTICK[i][pos];
+}
+
+unsigned int TuneLength()
+{ //frames till every track ended or reached its first loop (TIMELINE_UNKNOWN if not compiled that far yet)
+ unsigned int length=0, tracklength;
+ int i;
+ for (i=0;i<TrackAmount;i++)
+ {
+  tracklength=(ENDTICK[i]<LOOPTICK[i])? ENDTICK[i] : LOOPTICK[i];
+  if (tracklength==TIMELINE_UNKNOWN) return TIMELINE_UNKNOWN;
+  if (tracklength>length) length=tracklength;
+ }
+ return length;
+}
+
+void TimelineReset()
+{ //drop the whole timeline, compiling restarts from the beginning of the tune
+ PlayerSnapshot LiveState;
+ int i,j;
+ SaveSnapshot(LiveState);
+ for (i=0;i<TrackAmount;i++)
+ {
+  TIMELINE[i].clear(); TLCURSOR[i]=0; TLRAMP[i]=-1; Looped[i]=false;
+  SEQINDEX[i].clear(); LOOPTICK[i]=ENDTICK[i]=TIMELINE_UNKNOWN;
+ }
+ Checkpoints.clear(); TimelineDone=false; CompileTarget=0;
+ for (i=0;i<256;i++) { PTNTICK[i]=INSTTICK[i]=TIMELINE_UNKNOWN; for (j=0;j<TrackAmount;j++) SEQTICK[j][i]=TIMELINE_UNKNOWN; }
+ ResetPlayerState(true);
+ memset(CHANNELS,CHANNEL_UNKNOWN,sizeof(CHANNELS));
+ CompileMode=ScanMode=true; //the settings sent by InitRoutine
+ for (i=0;i<TrackAmount;i++) { SelectIns(PLAYEDINS[i]); SetVolume(PLAYEDINS[i],0x7F); }
+ CompileMode=ScanMode=false;
+ for (i=0;i<TrackAmount;i++) { TimelineSeqEntered(i,0); TimelineInstrUsed(PLAYEDINS[i]); }
+ SaveSnapshot(TimelineState); Checkpoints.push_back(TimelineState); //the start is there before any compiling (F2 or seeking right after a reset)
+ LoadSnapshot(LiveState);
+ if (TimelinePlaying) TimelineResync=true;
+}
+
+void TimelineInvalidate(unsigned int frame)
+{ //throw away the events from the last checkpoint before 'frame', they will be compiled again
+ unsigned int i,j,cp;
+ if (frame==TIMELINE_UNKNOWN || frame>=TimelineState.Frame) return; //not compiled yet
+ cp=frame/TIMELINE_CHECKPOINT; if (cp>=Checkpoints.size()) cp=Checkpoints.size()-1;
+ TimelineState=Checkpoints[cp]; Checkpoints.resize(cp+1); TimelineDone=false;
+ for (i=0;i<TrackAmount;i++)
+ {
+  TIMELINE[i].resize(TimelineState.Events[i]);
+  for (j=TIMELINE[i].size(); j>0; j--) if (TIMELINE[i][j-1].Type==TLEV_RAMP) //a ramp running through the checkpoint is cut there
+  {
+   if (TIMELINE[i][j-1].Frame+TIMELINE[i][j-1].Count > TimelineState.Frame) TIMELINE[i][j-1].Count=TimelineState.Frame-TIMELINE[i][j-1].Frame;
+   break;
+  }
+  SEQINDEX[i].resize(IndexSearch(i,TimelineState.Frame));
+  if (LOOPTICK[i]!=TIMELINE_UNKNOWN && LOOPTICK[i]>=TimelineState.Frame) LOOPTICK[i]=TIMELINE_UNKNOWN;
+  if (ENDTICK[i]!=TIMELINE_UNKNOWN && ENDTICK[i]>=TimelineState.Frame) ENDTICK[i]=TIMELINE_UNKNOWN;
+ }
+ for (i=0;i<256;i++)
+ {
+  if (PTNTICK[i]!=TIMELINE_UNKNOWN && PTNTICK[i]>=TimelineState.Frame) PTNTICK[i]=TIMELINE_UNKNOWN;
+  if (INSTTICK[i]!=TIMELINE_UNKNOWN && INSTTICK[i]>=TimelineState.Frame) INSTTICK[i]=TIMELINE_UNKNOWN;
+  for (j=0;j<TrackAmount;j++) if (SEQTICK[j][i]!=TIMELINE_UNKNOWN && SEQTICK[j][i]>=TimelineState.Frame) SEQTICK[j][i]=TIMELINE_UNKNOWN;
+ }
+ if (TimelinePlaying) TimelineResync=true;
+}
+
+void DirtyPattern(unsigned char ptn)
+{ //pattern-data or -length was edited
+ TimelineInvalidate(PTNTICK[ptn]);
+}
+
+void DirtySequence(int track, int pos)
+{ //orderlist was edited at 'pos' (insertion/deletion shifts the rest too), an FE before 'pos' may jump here
+ unsigned int frame=TIMELINE_UNKNOWN;
+ int i;
+ for (i=(pos>0)?pos-1:0; i<256; i++) if (SEQTICK[track][i]<frame) frame=SEQTICK[track][i];
+ TimelineInvalidate(frame);
+}
+
+void DirtyInstrument(unsigned char ins)
+{ //instrument-data was edited: from its first use on (the default instruments are in the starting state too)
+ if (INSTTICK[ins]==0) TimelineReset(); else TimelineInvalidate(INSTTICK[ins]);
+}
+
+void DirtyTune()
+{ //instruments, default instruments or the whole tune changed
+ TimelineReset();
+}
+
+void TimelineCompile(int frames)
+{ //continue compiling the timeline by max. 'frames' frames, the live player-state is kept
+ PlayerSnapshot LiveState;
+ int i, LivePlayMode=PlayMode, LiveTrack=CurrentTrack;
+ bool LiveFollow=FollowPlay, LiveExport=ExportMode;
+ if (TimelineDone) return;
+ SaveSnapshot(LiveState); LoadSnapshot(TimelineState);
+ CompileMode=true; FollowPlay=ExportMode=false; PlayMode=1;
+ while (frames-- > 0 && !TimelineDone)
+ {
+  if (PLAYFRAME==Checkpoints.size()*TIMELINE_CHECKPOINT) { SaveSnapshot(TimelineState); Checkpoints.push_back(TimelineState); }
+  PlayFrame();
+  TimelineDone=true; for (i=0;i<TrackAmount;i++) if (!EndOfTrack[i] && (!Looped[i] || PLAYFRAME<=CompileTarget)) TimelineDone=false;
+  if (PLAYFRAME>=TIMELINE_MAXFRAMES) TimelineDone=true;
+ }
+ SaveSnapshot(TimelineState);
+ CompileMode=false; FollowPlay=LiveFollow; ExportMode=LiveExport; PlayMode=LivePlayMode; CurrentTrack=LiveTrack;
+ LoadSnapshot(LiveState);
+}
+
+void TimelineBackground()
+{ //a slice of compiling between the timer-events, limited by time (a busy tune compiles slower)
+ Uint32 start=SDL_GetTicks();
+ if (Previewing) return; //the preview has the music-data
+ while (!TimelineDone && SDL_GetTicks()-start<TIMELINE_SLICE_MS) TimelineCompile(TIMELINE_BATCH);
+}
+
+void TimelineCompileTo(unsigned int frame)
+{ //make sure that the timeline covers 'frame', compiling over the loops of the tune if needed
+ int i;
+ bool ended=true;
+ if (frame>CompileTarget) CompileTarget=frame;
+ for (i=0;i<TrackAmount;i++) if (!TimelineState.EndOfTrack[i]) ended=false;
+ if (TimelineState.Frame<=frame && TimelineState.Frame<TIMELINE_MAXFRAMES && !ended) TimelineDone=false;
+ while (!TimelineDone && TimelineState.Frame<=frame) TimelineCompile(TIMELINE_SLICE);
+}
+
+void TimelineStart()
+{ //F1/export: play the timeline from the actual PLAYFRAME (after InitRoutine)
+ TimelinePlaying=true; TimelineResync=true;
+}
+
+void TimelineStop()
+{
+ TimelinePlaying=false;
+}
+
+void TimelineSeek()
+{ //compile up to the playing frame and reposition the cursors there (after start or edits)
+ unsigned int i,j;
+ TimelineCompileTo(PLAYFRAME);
+ for (i=0;i<TrackAmount;i++)
+ {
+  std::vector<TimelineEvent> &events=TIMELINE[i];
+  TLCURSOR[i]=EventSearch(i,PLAYFRAME);
+  TLRAMP[i]=-1; for (j=TLCURSOR[i]; j>0; j--) if (events[j-1].Type==TLEV_RAMP) { TLRAMP[i]=j-1; break; }
+  EndOfTrack[i]=false; for (j=TLCURSOR[i]; j>0 && j+2>TLCURSOR[i]; j--) if (events[j-1].Type==TLEV_END) EndOfTrack[i]=true;
+ }
+ FindPlayingTracks();
+ TimelineResync=false;
+}
+
+void TimelineHandover()
+{ //end of the compiled timeline: the interpreter continues from the state where compiling stopped
+ bool Ended[TrackAmount];
+ unsigned char Notes[TrackAmount][PtnNoteColumns];
+ int i;
+ for (i=0;i<TrackAmount;i++) Ended[i]=EndOfTrack[i];
+ memcpy(Notes,prevnote,sizeof(Notes));
+ LoadSnapshot(TimelineState);
+ for (i=0;i<TrackAmount;i++) EndOfTrack[i]=EndOfTrack[i]||Ended[i];
+ memcpy(prevnote,Notes,sizeof(Notes)); FindPlayingTracks();
+ TimelinePlaying=false;
+}
+
+void PlayTimelineEvent(int i, TimelineEvent &event)
+{ //play an event of track 'i'
+ unsigned int j;
+ switch (event.Type)
+ {
+  case TLEV_NOTEON: if (!mutesolo[i]) break; 
+                    prevnote[i][event.Value]=event.Data[1]+1; //fall through
+  case TLEV_MIDI: for (j=0;j<event.Size;j++) PlayerMessage.push_back(event.Data[j]); 
+                  CarefulMessage(event.Instr);
+         break;
+  case TLEV_NOTEOFF: if (prevnote[i][event.Value]==0) break;
+                     PlayerMessage.push_back(event.Data[0]); PlayerMessage.push_back(prevnote[i][event.Value]-1); PlayerMessage.push_back(event.Data[2]);
+                     CarefulMessage(event.Instr);
+         break;
+  case TLEV_RAMP: SetPitchWheel(event.Instr,0x2000+event.Value);
+         break;
+  case TLEV_INSTR: PLAYEDINS[i]=event.Value; DispTrkInfo();
+         break;
+  case TLEV_TEMPO: SetTempo(i,event.Value); //followed for the tempo-map of the export
+         break;
+  case TLEV_ROW: SEQCNT[i]=event.Value; PATTCNT[i]=event.Step; SPDCNT[i]=0; 
+                 if (!FollowPlay) DisPattCnt(i);
+                 AdvanceRow(i,SEQUENCE[i][SEQCNT[i]]); //jumps & track-ends are handled as by the interpreter
+         break;
+  default: break;
+ }
+}
+
+void TimelineFrame()
+{ //one 20ms frame read from the timeline
+ int i;
+ if (TimelineResync) TimelineSeek();
+ if (PLAYFRAME>=TimelineState.Frame)
+ {
+  TimelineCompileTo(PLAYFRAME); 
+  if (PLAYFRAME>=TimelineState.Frame) { TimelineHandover(); PlayFrame(); return; } //1 hour passed or all tracks ended
+ }
+ for (i=TrackAmount-1;i>=0;i--)
+ {
+  std::vector<TimelineEvent> &events=TIMELINE[i];
+  if (EndOfTrack[i]) continue;
+  CurrentTrack=i; SPDCNT[i]=1;
+  while (TLCURSOR[i]<events.size() && events[TLCURSOR[i]].Frame==PLAYFRAME)
+  {
+   if (events[TLCURSOR[i]].Type==TLEV_RAMP) TLRAMP[i]=TLCURSOR[i];
+   PlayTimelineEvent(i,events[TLCURSOR[i]++]);
+  }
+  if (TLRAMP[i]>=0) 
+  {
+   TimelineEvent &ramp=events[TLRAMP[i]];
+   if (ramp.Frame<PLAYFRAME && ramp.Frame+ramp.Count>PLAYFRAME) SetPitchWheel(ramp.Instr,0x2000+ramp.Value+ramp.Step*(PLAYFRAME-ramp.Frame));
+  }
+ }
+ ClockFrame(); MtcFrame(); PLAYFRAME++;
+}
+
+//---------------------------------------------------------------------------------------------
+//------------------------------ CHANNEL-STATE & SEEK -----------------------------------------
+int ChannelSlot(unsigned char instr)
+{ //slot of the port/channel pair of an instrument in the channel-states, a new one is taken at the first use
+ int port=ROUTE[instr].Port, channel=ROUTE[instr].Channel;
+ if (CHSLOT[port][channel]==0)
+ {
+  if (SlotAmount>=CHANNEL_SLOTS) return -1;
+  memset(&CHANNELS[SlotAmount],CHANNEL_UNKNOWN,sizeof(ChannelState)); memset(&SynthState[SlotAmount],CHANNEL_UNKNOWN,sizeof(ChannelState));
+  memset(&ExportState[SlotAmount],CHANNEL_UNKNOWN,sizeof(ChannelState));
+  memset(PendingValue[FILTER_LIVE][SlotAmount],0xFF,sizeof(PendingValue[0][0])); memset(PendingValue[FILTER_EXPORT][SlotAmount],0xFF,sizeof(PendingValue[0][0]));
+  PendingCount[FILTER_LIVE][SlotAmount]=PendingCount[FILTER_EXPORT][SlotAmount]=0;
+  SlotPort[SlotAmount]=port; SlotChannel[SlotAmount]=channel; CHSLOT[port][channel]=++SlotAmount;
+ }
+ return CHSLOT[port][channel]-1;
+}
+
+void ChannelMessage(ChannelState *states, unsigned char instr)
+{ //follow the program/controller/pitch-wheel settings of the PlayerMessage (can contain more messages)
+ unsigned int i=0;
+ int slot=ChannelSlot(instr);
+ if (slot<0) return;
+ ChannelState &state=states[slot];
+ while (i<PlayerMessage.size())
+ {
+  switch (PlayerMessage.at(i)&0xF0)
+  {
+   case 0xB0: if (i+2<PlayerMessage.size() && PlayerMessage.at(i+1)<0x78) state.CC[PlayerMessage.at(i+1)]=PlayerMessage.at(i+2); 
+              i+=3; break;
+   case 0xC0: if (i+1<PlayerMessage.size()) state.Program=PlayerMessage.at(i+1); 
+              i+=2; break;
+   case 0xD0: if (i+1<PlayerMessage.size()) state.Pressure=PlayerMessage.at(i+1); 
+              i+=2; break;
+   case 0xE0: if (i+2<PlayerMessage.size()) state.PitchBend=PlayerMessage.at(i+1)+PlayerMessage.at(i+2)*128; 
+              i+=3; break;
+   default: i+=3; break; //note on/off
+  }
+ }
+}
+
+bool ShapedCC(unsigned char cc)
+{ //continuous controllers (MSBs and sound/effect-depths), switches, bank and (N)RPN data-entry keep every value
+ return (cc>=1 && cc<=31 && cc!=6) || (cc>=70 && cc<=79) || (cc>=91 && cc<=95);
+}
+
+bool StreamHold(int filter, int slot, int stream, unsigned short value, unsigned short sent, unsigned char instr)
+{ //the stream-shaper decides at the end of the frame, the first value of a resting stream goes at once (before the note it's set for)
+ StreamQuality &quality=StreamPresets[StreamPreset[filter]];
+ int diff=value-sent; 
+ if (diff<0) diff=-diff;
+ if (PendingValue[filter][slot][stream]==0xFFFF)
+ {
+  if (value==sent) return false; //redundant
+  if (sent==0xFFFF || (ShaperTick[filter]-LastSent[filter][slot][stream]>=quality.Interval && diff>=((stream==STREAM_BEND)? quality.Deadband : quality.CCDeadband)))
+  { LastSent[filter][slot][stream]=ShaperTick[filter]; return false; }
+ }
+ if (PendingValue[filter][slot][stream]!=0xFFFF) MessagesThinned[filter]++;
+ else PendingCount[filter][slot]++;
+ PendingValue[filter][slot][stream]=value; PendingInstr[filter][slot]=instr; PendingFresh[filter][slot][stream]=true;
+ return true;
+}
+
+void StreamDrop(int filter, int slot, int stream)
+{
+ if (PendingValue[filter][slot][stream]==0xFFFF) return;
+ PendingValue[filter][slot][stream]=0xFFFF; PendingCount[filter][slot]--;
+}
+
+void FilterMessage(ChannelState *states, unsigned char instr, int filter)
+{ //drop the messages of PlayerMessage that wouldn't change the program/controller/pitch-wheel state of the channel
+ std::vector<unsigned char> passed;
+ unsigned int i=0, size;
+ unsigned char data1,data2;
+ bool redundant;
+ int slot=ChannelSlot(instr);
+ if (slot<0) return; //not followed, sent as it is
+ ChannelState &state=states[slot];
+ while (i<PlayerMessage.size())
+ {
+  size=((PlayerMessage.at(i)&0xE0)==0xC0)? 2 : 3; //program-change and channel-pressure have 1 data-byte
+  if (i+size>PlayerMessage.size()) size=PlayerMessage.size()-i;
+  data1=(size>1)? PlayerMessage.at(i+1) : 0; data2=(size>2)? PlayerMessage.at(i+2) : 0; redundant=false;
+  switch (PlayerMessage.at(i)&0xF0)
+  {
+   case 0xB0: if (data1==0x79) 
+              { //reset all controllers, held back values are overwritten by it
+               memset(state.CC,CHANNEL_UNKNOWN,sizeof(state.CC)); state.Pressure=CHANNEL_UNKNOWN; state.PitchBend=0xFFFF;
+               memset(PendingValue[filter][slot],0xFF,sizeof(PendingValue[0][0])); PendingCount[filter][slot]=0;
+              }
+              if (data1>=0x78 || data1==6 || data1==38 || (data1>=96 && data1<=101)) break; //channel-mode & (N)RPN data-entry messages always go
+              if (data1>=33 && data1<=63 && PendingValue[filter][slot][data1-32]!=0xFFFF)
+              { //an LSB follows its MSB: the held back MSB goes first
+               passed.push_back(0xB0+SlotChannel[slot]); passed.push_back(data1-32); passed.push_back(PendingValue[filter][slot][data1-32]);
+               state.CC[data1-32]=PendingValue[filter][slot][data1-32]; LastSent[filter][slot][data1-32]=ShaperTick[filter]; StreamDrop(filter,slot,data1-32); MessagesSent[filter]++;
+              }
+              if (StreamPreset[filter] && ShapedCC(data1) && StreamHold(filter,slot,data1,data2,(state.CC[data1]==CHANNEL_UNKNOWN)? 0xFFFF : state.CC[data1],instr)) { i+=size; continue; }
+              redundant=(state.CC[data1]==data2); state.CC[data1]=data2;
+              if (!redundant && (data1==0 || data1==32)) state.Program=CHANNEL_UNKNOWN; //a new bank is only selected by the next program-change
+              break;
+   case 0xC0: redundant=(state.Program==data1); state.Program=data1;
+              break;
+   case 0xD0: redundant=(state.Pressure==data1); state.Pressure=data1;
+              break;
+   case 0xE0: if (StreamPreset[filter] && StreamHold(filter,slot,STREAM_BEND,data1+data2*128,state.PitchBend,instr)) { i+=size; continue; }
+              redundant=(state.PitchBend==data1+data2*128); state.PitchBend=data1+data2*128;
+              break;
+   default: break; //note on/off
+  }
+  if (redundant) MessagesSaved[filter]++;
+  else { MessagesSent[filter]++; passed.insert(passed.end(),PlayerMessage.begin()+i,PlayerMessage.begin()+i+size); }
+  i+=size;
+ }
+ PlayerMessage.swap(passed);
+}
+
+void ShaperReset(int filter)
+{ //forget the held back pitch-wheel/controller values (the channel-state is restored or the playback restarts)
+ memset(PendingValue[filter],0xFF,sizeof(PendingValue[0])); memset(PendingCount[filter],0,sizeof(PendingCount[0]));
+}
+
+void ShaperFrame(int filter)
+{ //end of a frame: held back pitch-wheel/controller values are sent if the stream paused, or deadband/rate/port-budget allow it
+ ChannelState *states=(filter==FILTER_LIVE)? SynthState : ExportState;
+ StreamQuality &quality=StreamPresets[StreamPreset[filter]];
+ int i,j,slot,diff,deadband;
+ unsigned short value,sent;
+ ShaperTick[filter]++;
+ for (i=0;i<SlotAmount;i++)
+ {
+  slot=(i+ShaperTick[filter])%SlotAmount; //rotating start: no channel is always the last to get the budget
+  for (j=STREAM_BEND;j>=0 && PendingCount[filter][slot];j--) //pitch-wheel first
+  {
+   value=PendingValue[filter][slot][j];
+   if (value==0xFFFF) continue;
+   if (j==STREAM_BEND) { sent=states[slot].PitchBend; deadband=quality.Deadband; }
+   else { sent=(states[slot].CC[j]==CHANNEL_UNKNOWN)? 0xFFFF : states[slot].CC[j]; deadband=quality.CCDeadband; }
+   if (value==sent) { StreamDrop(filter,slot,j); MessagesThinned[filter]++; continue; }
+   diff=value-sent; if (diff<0) diff=-diff;
+   if (PendingFresh[filter][slot][j] && (ShaperTick[filter]-LastSent[filter][slot][j]<quality.Interval || (sent!=0xFFFF && diff<deadband)))
+   { PendingFresh[filter][slot][j]=false; continue; } //a stream paused for a frame gets its last value sent
+   if (filter==FILTER_LIVE && quality.Budget && PortBudget[SlotPort[slot]] && BudgetUsed[SlotPort[slot]]+3>PortBudget[SlotPort[slot]]) break;
+   if (j==STREAM_BEND) { PlayerMessage.push_back(0xE0+SlotChannel[slot]); PlayerMessage.push_back(value&0x7F); PlayerMessage.push_back(value/128); states[slot].PitchBend=value; }
+   else { PlayerMessage.push_back(0xB0+SlotChannel[slot]); PlayerMessage.push_back(j); PlayerMessage.push_back(value); states[slot].CC[j]=value; }
+   if (filter==FILTER_LIVE) SlotMessage(slot); else MessageToExport(PendingInstr[filter][slot]);
+   LastSent[filter][slot][j]=ShaperTick[filter]; StreamDrop(filter,slot,j); PendingFresh[filter][slot][j]=false;
+   MessagesSent[filter]++;
+  }
+ }
+}
+
+void SlotMessage(int slot)
+{ //send PlayerMessage to the port of a channel-slot
+ BudgetUsed[SlotPort[slot]]+=PlayerMessage.size();
+ PortSend(SlotPort[slot],&PlayerMessage);
+ PlayerMessage.clear();
+}
+
+void ChannelRestore(ChannelState *target)
+{ //send only the settings that differ from what the ports already got
+ int i,j;
+ ShaperReset(FILTER_LIVE);
+ for (i=0;i<SlotAmount;i++)
+ {
+  ChannelState &synth=SynthState[i];
+  unsigned char status=SlotChannel[i];
+  if (target[i].Program!=CHANNEL_UNKNOWN && target[i].Program!=synth.Program)
+  {
+   PlayerMessage.push_back(0xC0+status); PlayerMessage.push_back(target[i].Program); SlotMessage(i);
+   synth.Program=target[i].Program;
+  }
+  for (j=0;j<0x78;j++) if (target[i].CC[j]!=CHANNEL_UNKNOWN && target[i].CC[j]!=synth.CC[j])
+  {
+   PlayerMessage.push_back(0xB0+status); PlayerMessage.push_back(j); PlayerMessage.push_back(target[i].CC[j]); SlotMessage(i);
+   synth.CC[j]=target[i].CC[j];
+  }
+  if (target[i].PitchBend!=0xFFFF && target[i].PitchBend!=synth.PitchBend)
+  {
+   PlayerMessage.push_back(0xE0+status); PlayerMessage.push_back(target[i].PitchBend&0x7F); PlayerMessage.push_back(target[i].PitchBend/128); SlotMessage(i);
+   synth.PitchBend=target[i].PitchBend;
+  }
+  if (target[i].Pressure!=CHANNEL_UNKNOWN && target[i].Pressure!=synth.Pressure)
+  {
+   PlayerMessage.push_back(0xD0+status); PlayerMessage.push_back(target[i].Pressure); SlotMessage(i);
+   synth.Pressure=target[i].Pressure;
+  }
+ }
+}
+
+void ScanTo(unsigned int frame)
+{ //player-state at the start of 'frame' of the tune: the last checkpoint before it is restored and the player runs silently from there
+ unsigned int cp;
+ bool LiveFollow=FollowPlay;
+ int LivePlayMode=PlayMode;
+ TimelineCompileTo(frame);
+ cp=frame/TIMELINE_CHECKPOINT; if (cp>=Checkpoints.size()) cp=Checkpoints.size()-1;
+ LoadSnapshot(Checkpoints[cp]);
+ CompileMode=ScanMode=true; FollowPlay=false; PlayMode=1;
+ while (PLAYFRAME<frame) PlayFrame();
+ CompileMode=ScanMode=false; FollowPlay=LiveFollow; PlayMode=LivePlayMode;
+}
+
+void ScanToClock(unsigned long long pos)
+{ //player-state at the frame reaching song-position 'pos' (in 1/65536 MIDI-clocks), the same way as ScanTo
+ unsigned int cp;
+ bool LiveFollow=FollowPlay;
+ int LivePlayMode=PlayMode;
+ TimelineCompileTo(0);
+ while (!TimelineDone && TimelineState.ClockPos<=pos) TimelineCompile(TIMELINE_SLICE);
+ for (cp=Checkpoints.size()-1; cp>0 && Checkpoints[cp].ClockPos>pos; cp--);
+ LoadSnapshot(Checkpoints[cp]);
+ CompileMode=ScanMode=true; FollowPlay=false; PlayMode=1;
+ while (CLOCKPOS+ClockRate()<=pos && TracksPlaying) PlayFrame();
+ CompileMode=ScanMode=false; FollowPlay=LiveFollow; PlayMode=LivePlayMode;
+}
 
-int CarefulMessage(unsigned char instr)
-{
- if (ExportMode==false)
- { //playback-mode
-  try{ PortOut[INSTRUMENT[instr][INST_PORT]]->sendMessage( &PlayerMessage ); } catch( RtError &error ) {error.printMessage();}
-  PlayerMessage.clear(); 
+void SeekMarkers()
+{ //F2: every track starts at its play-mark with the instrument, tempo and controller-state it has there in the tune
+ PlayerSnapshot Start;
+ ChannelState Target[CHANNEL_SLOTS];
+ int i,slot;
+ unsigned int frame;
+ bool clockset=false;
+ for (i=0;i<TrackAmount;i++) while (!TimelineDone && SEQTICK[i][F2playMarker[i]]==TIMELINE_UNKNOWN) TimelineCompile(TIMELINE_SLICE);
+ SaveSnapshot(Start);
+ memcpy(Target,Checkpoints[0].Channels,sizeof(Target)); //settings of InitRoutine for tracks not reaching their marks
+ for (i=0;i<TrackAmount;i++)
+ {
+  frame=SEQTICK[i][F2playMarker[i]];
+  if (frame==TIMELINE_UNKNOWN) continue;
+  ScanTo(frame+1);
+  Start.Tempo[i]=TEMPO[i]; Start.SpdCnt[i]=TEMPO[i]; Start.PlayedIns[i]=PLAYEDINS[i]; 
+  Start.Bpm[i]=BPM[i]; Start.RowsPerBeat[i]=ROWSPERBEAT[i]; Start.RowLength[i]=Start.RowClock[i]=ROWLENGTH[i]; Start.TuneBpm=TuneBPM;
+  Start.SlideSpeed[i]=SlideSpeed[i]; Start.SlideCnt[i]=SlideCnt[i]; Start.Vibrato[i]=Vibrato[i];
+  if (!clockset) { Start.ClockPos=(CLOCKPOS>ClockRate())? CLOCKPOS-ClockRate() : 0; clockset=true; } //song-position of the first mark's row
+  slot=ChannelSlot(PLAYEDINS[i]); if (slot>=0) Target[slot]=CHANNELS[slot];
+ }
+ LoadSnapshot(Start);
+ ChannelRestore(Target);
+}
+
+bool ScrubTimeline=false; //timeline-playback was interrupted by fast-forward/rewind
+unsigned char ScrubSpeeds[10]={100,2,3,4,6,8,12,16,32,64}; //fast-forward/rewind speeds selected by Alt+0..9
+
+void Scrub(int frames)
+{ //fast-forward (frames>0) / rewind (frames<0): the player only follows the state, no notes are sent
+ int i;
+ if (!Scrubbing)
+ {
+  KUSS(); ClockTransport(MIDI_STOP); memcpy(CHANNELS,SynthState,sizeof(CHANNELS)); //the controllers sent so far
+  ScrubTimeline=TimelinePlaying;
+  if (TimelinePlaying) { ScanTo(PLAYFRAME); TimelineStop(); } //the interpreter takes over at the position of the timeline
+  Scrubbing=true;
+ }
+ if (frames<0)
+ {
+  if (!PlayedFromStart || PlayMode!=1) return; //only the tune started by F1 has checkpoints to go back to
+  ScanTo((PLAYFRAME>(unsigned int)-frames)? PLAYFRAME+frames : 0);
+  if (FollowPlay) { for (i=0;i<TrackAmount;i++) if (SEQUENCE[i][SEQCNT[i]]<ORDERLIST_FX_MIN) selpatt[i]=SEQUENCE[i][SEQCNT[i]]; DisPattData(); }
+  FrameEnd();
  }
  else
- { //MIDI-export mode
-  MessageToExport(instr); 
+ {
+  CompileMode=ScanMode=true;
+  for (i=0;i<frames && !EndOfTune;i++) { PlayFrame(); FrameEnd(); }
+  CompileMode=ScanMode=false;
  }
- return 0;
+ for (i=0;i<TrackAmount;i++) { DisPattCnt(i); DispSeqCnt(i); }
 }
 
-//-----------------------------------------------
-void NoteOn(unsigned char instr, unsigned char note, unsigned char velo)
-{
- unsigned int mulvelo = (INSTRUMENT[instr][INST_CHVOL]&0xF) ? (velo*(INSTRUMENT[instr][INST_CHVOL]&0xF))/16 : velo; //0 means full volume
- PlayerMessage.push_back(0x90+(INSTRUMENT[instr][INST_CHVOL]/16)); PlayerMessage.push_back(note-1); PlayerMessage.push_back(mulvelo);
- CarefulMessage(instr);
+void ScrubEnd()
+{ //back to normal playback, the controllers changed meanwhile are sent
+ ChannelRestore(CHANNELS); Scrubbing=false; ClockTransport(MIDI_CONTINUE);
+ if (ScrubTimeline) TimelineStart();
 }
 
-void NoteOff(unsigned char instr, unsigned char note, unsigned char velo)
-{
- unsigned int mulvelo = (INSTRUMENT[instr][INST_CHVOL]&0xF) ? (velo*(INSTRUMENT[instr][INST_CHVOL]&0xF))/16 : velo; //0 means full volume
- PlayerMessage.push_back(0x80+(INSTRUMENT[instr][INST_CHVOL]/16)); PlayerMessage.push_back(note-1); PlayerMessage.push_back(mulvelo);
- CarefulMessage(instr);
+//---------------------------------------------------------------------------------------------
+//------------------------------ MIDI-CLOCK MASTER --------------------------------------------
+//The song-position advances with the player's tempo every frame. The clocks falling into a frame are sent timed
+//inside it through the delay-lines of the ports, so they don't come in 20ms bursts.
+unsigned int ClockRate()
+{ //MIDI-clocks of a frame in 1/65536: BPM-tempo, or frame-tempo with ROWSPERBEAT rows (of TEMPO+2 frames) in a beat
+ unsigned int rows=(ROWSPERBEAT[0])? ROWSPERBEAT[0] : defrowsperbeat;
+ if (TuneBPM) return (24*65536*TuneBPM)/3000; //3000 frames in a minute
+ return (24*65536)/(rows*(TEMPO[0]+2));
 }
 
-void AllNotesOff(unsigned char instr)
-{
- PlayerMessage.push_back(0xB0+(INSTRUMENT[instr][INST_CHVOL]/16)); PlayerMessage.push_back(0x7B); PlayerMessage.push_back(0);
- CarefulMessage(instr);
+void ClockFrame()
+{ //advance the song-position by a frame, sending the clocks inside it
+ unsigned int rate=ClockRate(), offset, i;
+ unsigned long long clock;
+ std::vector<unsigned char> tick(1,MIDI_CLOCK);
+ if (ClockPorts.size() && PlayMode && !CompileMode && !ExportMode && !EndOfTune)
+ {
+  for (clock=(CLOCKPOS+65535)>>16; (clock<<16)<CLOCKPOS+rate; clock++)
+  {
+   if (clock<ClockHold) continue;
+   offset=(unsigned int)(((clock<<16)-CLOCKPOS)*20/rate); //ms inside the frame
+   for (i=0;i<ClockPorts.size();i++) PortSendLater(ClockPorts[i],&tick,PortDelay[ClockPorts[i]]+offset);
+  }
+ }
+ CLOCKPOS+=rate;
 }
 
-void SelectIns(unsigned char instr)
-{
- if (!INSTRUMENT[instr][0] && !INSTRUMENT[instr][1] && !INSTRUMENT[instr][2]) return; //avoid empty instrument (can cause loopback) //if (instr<1 || instr>0x80) return;
- PlayerMessage.push_back(0xC0+(INSTRUMENT[instr][INST_CHVOL]/16)); PlayerMessage.push_back(INSTRUMENT[instr][INST_PATCH]-1); //instruments in MIDItrk start from 1
- CarefulMessage(instr);
+void ClockTransport(unsigned char status)
+{ //start (from 0) / continue (from CLOCKPOS, after a song-position pointer) / stop to the clock-ports
+ std::vector<unsigned char> message;
+ unsigned int i, sixteenth;
+ if (status!=MIDI_STOP) MtcLocate(); //the timecode-ports learn the position too
+ if (ClockPorts.empty()) return;
+ if (status==MIDI_CONTINUE)
+ { //the next 16th note from the song-position, the clocks wait for it
+  sixteenth=(unsigned int)((((CLOCKPOS+65535)>>16)+5)/6); if (sixteenth>0x3FFF) sixteenth=0x3FFF;
+  ClockHold=sixteenth*6;
+  message.push_back(0xF2); message.push_back(sixteenth&0x7F); message.push_back(sixteenth>>7);
+  for (i=0;i<ClockPorts.size();i++) PortSend(ClockPorts[i],&message);
+  message.clear();
+ }
+ else if (status==MIDI_START) ClockHold=0;
+ message.push_back(status);
+ for (i=0;i<ClockPorts.size();i++) PortSend(ClockPorts[i],&message);
 }
 
-void SetVolume(unsigned char instr, unsigned char volume)
-{
- PlayerMessage.push_back(0xB0+(INSTRUMENT[instr][INST_CHVOL]/16)); PlayerMessage.push_back(0x07); PlayerMessage.push_back(volume);
- CarefulMessage(instr); 
+void ClockRewind()
+{ //song-position pointer 0 while the clock runs on (the next tune of a setlist starts), no clock is held back
+ std::vector<unsigned char> message(3,0);
+ unsigned int i;
+ ClockHold=0; MtcLocate();
+ message[0]=0xF2;
+ for (i=0;i<ClockPorts.size();i++) PortSend(ClockPorts[i],&message);
 }
 
-void SetAfterTouch(unsigned char instr, unsigned char aftertouch)
-{
- PlayerMessage.push_back(0xD0+(INSTRUMENT[instr][INST_CHVOL]/16)); PlayerMessage.push_back(aftertouch);
- CarefulMessage(instr);
+//---------------------------------------------------------------------------------------------
+//------------------------------ MIDI-CLOCK SLAVE ---------------------------------------------
+//The input-thread counts the master's clocks and smooths their period by a PLL. The main loop plays the frames the
+//master's song-position reached, interpolated between the clocks, so the tune's own tempo only sets clocks per frame.
+void PllInput()
+{ //input-thread: the PLL follows a clock (quarter-frame) of the master
+ double error=InputTime-(PllTime+PllPeriod);
+ if (PllTime==0 || PllPeriod==0 || error>PllPeriod || -error>PllPeriod)
+ { //(re)lock to the interval of the last 2 clocks
+  PllPeriod=(PllTime==0)? 0 : InputTime-PllTime; PllTime=InputTime;
+ }
+ else
+ {
+  PllTime+=PllPeriod+error*PLL_PHASE; PllPeriod+=error*PLL_FREQ;
+  ExtJitter+=(((error<0)?-error:error)-ExtJitter)/16;
+ }
+ ExtPeriod=PllPeriod;
 }
 
-void SetPitchWheel(unsigned char instr, unsigned int pitchwheel) //pitchwheel walue: 0000...2000(middle)...3FFF
-{
- PlayerMessage.push_back(0xE0+(INSTRUMENT[instr][INST_CHVOL]/16)); PlayerMessage.push_back(pitchwheel&0x1F); PlayerMessage.push_back(pitchwheel/0x80);
- CarefulMessage(instr);
+void ClockInput(unsigned char status, std::vector<unsigned char> *message)
+{ //input-thread: clock, song-position pointer and transport of the master
+ switch (status)
+ {
+  case 0xF2: if (message->size()>=3) ExtClocks=(message->at(1)+message->at(2)*128)*6; break;
+  case MIDI_START: ExtClocks=0; //fall through
+  case MIDI_CONTINUE: ExtPlaying=ExtFirstClock=true; ExtTransport=status; break;
+  case MIDI_STOP: ExtPlaying=false; ExtTransport=status; break;
+  case MIDI_CLOCK:
+   PllInput();
+   if (ExtPlaying) { if (ExtFirstClock) ExtFirstClock=false; else ExtClocks++; ExtClockTicks=SDL_GetTicks(); }
+   break;
+ }
 }
 
-void UniqueCC(unsigned char instr, unsigned char CCnum, unsigned char value)
-{
- PlayerMessage.push_back(0xB0+(INSTRUMENT[instr][INST_CHVOL]/16)); PlayerMessage.push_back(CCnum); PlayerMessage.push_back(value);
- CarefulMessage(instr); 
+void SlaveFrames()
+{ //main-thread: transport of the master, then the frames its song-position has reached
+ unsigned char transport;
+ unsigned long long target, ext;
+ Uint32 elapsed, ticks;
+ double period;
+ bool playing;
+ int frames;
+ if (SlaveMode!=SLAVE_CLOCK) return;
+ SDL_LockMutex(InputLock); //a consistent copy of what the input-thread has counted, no transport lost
+ transport=ExtTransport; ExtTransport=0; ext=((unsigned long long)ExtClocks)<<16; ticks=ExtClockTicks; period=ExtPeriod; playing=ExtPlaying && !ExtFirstClock;
+ SDL_UnlockMutex(InputLock);
+ if (transport)
+ {
+  if (transport==MIDI_STOP) { if (PlayMode) { PrevPlayMode=PlayMode; PlayMode=0; FollowPlay=false; KUSS(); DispTrkInfo(); } }
+  else
+  {
+   FollowPlay=AutoFollow;
+   if (transport==MIDI_START) { InitRoutine(true); if (UseTimeline) TimelineStart(); }
+   else if (PlayMode==2 || ext+ClockRate()<=CLOCKPOS || CLOCKPOS+ClockRate()<=ext)
+   { //continued from elsewhere: the player seeks there, the controllers are restored as after rewinding
+    KUSS(); memcpy(CHANNELS,SynthState,sizeof(CHANNELS)); TimelineStop();
+    ScanToClock(ext); ChannelRestore(CHANNELS);
+    PlayedFromStart=true; if (UseTimeline) TimelineStart();
+   }
+   PlayMode=1; DispTrkInfo();
+  }
+  ClockTransport(transport); //clock-ports get the master's transport too
+ }
+ if (PlayMode!=1 || !playing || period<=0) return;
+ elapsed=SDL_GetTicks()-ticks;
+ target=ext + ((elapsed<period)? (unsigned long long)(elapsed*65536/period) : 65535); //not beyond the next clock
+ for (frames=0; frames<SLAVE_CATCHUP && CLOCKPOS<=target; frames++) { PlayRoutine(); DisplayTime(); }
 }
 
-void SetPortamento(unsigned char instr, unsigned char time)
-{
- PlayerMessage.push_back(0xB0+(INSTRUMENT[instr][INST_CHVOL]/16)); PlayerMessage.push_back(0x05); PlayerMessage.push_back(time);
- PlayerMessage.push_back(0xB0+(INSTRUMENT[instr][INST_CHVOL]/16)); PlayerMessage.push_back(65); PlayerMessage.push_back((time)?64:63);
- CarefulMessage(instr); 
+//---------------------------------------------------------------------------------------------
+//------------------------------ MIDI TIME CODE -----------------------------------------------
+//The timecode is the tune-time (PLAYFRAME*20ms) from MtcStart. Its quarter-frames are sent timed inside the frames
+//like the clocks, a full-frame message tells the position on start/continue. Chasing a timecode-master, the player
+//seeks to the timecode when it's located or starts running, then the main loop plays the frames its time reached:
+//the player waits when ahead and catches up when behind, and seeks again when it's more than MTC_WINDOW off.
+unsigned int MtcRateCode(unsigned int fps) { return (fps==24)? 0 : (fps==25)? 1 : 3; } //rate-bits of the timecode (2 is 29.97-drop)
+
+void MtcSplit(unsigned int frames, unsigned char *tc)
+{ //hh mm ss ff of the frame-count of the sent timecode (from MtcStart)
+ frames+=((MtcStart[0]*60+MtcStart[1])*60+MtcStart[2])*MtcFps+MtcStart[3];
+ tc[3]=frames%MtcFps; frames/=MtcFps; tc[2]=frames%60; frames/=60; tc[1]=frames%60; tc[0]=(frames/60)%24;
 }
 
-unsigned char SmallCCFXlist[16]={
-                  0x00, //0 select bank
-                  0x02, //1 breath controller
-                  0x04, //2 foot controller
-                  0x05, //3 portamento-time 
-                  0x08, //4 balance
-                  0x0a, //5 panning
-                  0x0b, //6 expression
-                  0x0c, //7 effect1
-                  0x0d, //8 effect2
-                  0x10, //9 general purpose 1
-                  0x11, //A general purpose 2
-                  0x44, //B switches: Damper Pedal(0x40), Portamento On/Off (0x41), Sustenuto On/Off (0x42), Soft Pedal On/Off (0x43), Legato footswitch (0x44), Hold 2 (0x45)
-                  0x5b, //C Effect1 Reverb level
-                  0x5c, //D Effect2 Tremolo level
-                  0x5d, //E Effect3 Chorus level
-                  0x5e};//F Effect4 Detune level
+void MtcFrame()
+{ //the quarter-frames falling into the frame (MtcFps*4 a second), piece 0 of each 8 starts the 2 frames they tell
+ unsigned long long quarter, from=(unsigned long long)PLAYFRAME*MtcFps*2; //quarter-frames*25 at the start of the frame
+ unsigned int piece, i; unsigned char tc[4], value;
+ std::vector<unsigned char> message(2,MIDI_QUARTERFRAME);
+ if (MtcPorts.empty() || !PlayMode || CompileMode || ExportMode || EndOfTune) return;
+ for (quarter=(from+24)/25; quarter*25<from+MtcFps*2; quarter++)
+ {
+  piece=quarter%8; MtcSplit((unsigned int)((quarter-piece)/4),tc);
+  value=(piece&1)? tc[3-piece/2]>>4 : tc[3-piece/2]&0xF;
+  if (piece==7) value|=MtcRateCode(MtcFps)<<1;
+  message[1]=(piece<<4)|value;
+  for (i=0;i<MtcPorts.size();i++) PortSendLater(MtcPorts[i],&message,PortDelay[MtcPorts[i]]+(unsigned int)((quarter*25-from)*10/MtcFps));
+ }
+}
 
-void SmallCCFX(unsigned char instr, unsigned char CCfx)
-{
- PlayerMessage.push_back(0xB0+(INSTRUMENT[instr][INST_CHVOL]/16)); PlayerMessage.push_back(SmallCCFXlist[CCfx/16]); PlayerMessage.push_back((CCfx&0xF)*8);
- CarefulMessage(instr); 
+void MtcLocate()
+{ //full-frame message F0 7F 7F 01 01 hh mm ss ff F7 of the position (hh has the rate-bits too)
+ unsigned char tc[4], fullframe[10]={0xF0,0x7F,0x7F,0x01,0x01,0,0,0,0,0xF7};
+ unsigned int i;
+ if (MtcPorts.empty()) return;
+ MtcSplit(PLAYFRAME*MtcFps/50,tc);
+ fullframe[5]=(MtcRateCode(MtcFps)<<5)|tc[0]; fullframe[6]=tc[1]; fullframe[7]=tc[2]; fullframe[8]=tc[3];
+ std::vector<unsigned char> message(fullframe,fullframe+10);
+ for (i=0;i<MtcPorts.size();i++) PortSend(MtcPorts[i],&message);
 }
 
-void KUSS()
-{
- int i;
- for (i=0;i<MaxInstAmount;i++) if(INSTRUMENT[i][0]||INSTRUMENT[i][1]||INSTRUMENT[i][2]) AllNotesOff(i);
+unsigned int MtcFrames(unsigned char hr, unsigned char mn, unsigned char sc, unsigned char fr)
+{ //input-thread: frame-count of a received timecode (rate-bits in hr), the frame-length of the master is set by it
+ unsigned int rate=(hr>>5)&3, fps=(rate==0)? 24 : (rate==1)? 25 : 30, minutes=(hr&0x1F)*60+(mn&0x3F);
+ unsigned int frames=(minutes*60+(sc&0x3F))*fps+(fr&0x1F);
+ ExtFrameLength=(rate==2)? 1001.0/30 : 1000.0/fps;
+ if (rate==2) frames-=2*(minutes-minutes/10); //drop-frame: frames 0 and 1 are skipped in the minutes not divisible by 10
+ return frames;
 }
 
-void InitRoutine(bool PlayFromBeginning)
-{
- int i;
- if (ExportMode==false) KUSS();
- for (i=0;i<TrackAmount;i++)
- {
-  SEQCNT[i]=(PlayFromBeginning)? 0 : F2playMarker[i];
-  PATTCNT[i]=0; Vibrato[i]=false; SlideSpeed[i]=SlideCnt[i]=0;
-  TEMPO[i]=deftempo; SPDCNT[i]=TEMPO[i]; DELAYCNT[i]=-1;
-  PLAYEDINS[i]=DefaultIns[i]; SelectIns(PLAYEDINS[i]); SetVolume(PLAYEDINS[i],0x7F);
-  //UniqueCC(PLAYEDINS[i],01,0x00); SetPitchWheel(PLAYEDINS[i],0x2000); //reset by new notes
-  EndOfTrack[i]=false;
-  DisPattCnt(i);
-  
-  if (FollowPlay) { selpatt[i]=SEQUENCE[i][SEQCNT[i]]; }
+void MtcInput(std::vector<unsigned char> *message)
+{ //input-thread: full-frame messages and quarter-frames of the timecode-master
+ unsigned char piece, *n=MtcNibble;
+ if (message->at(0)==0xF0)
+ { //full-frame F0 7F <device> 01 01 hh mm ss ff F7: located, stopped there
+  if (message->size()<10 || message->at(1)!=0x7F || message->at(3)!=0x01 || message->at(4)!=0x01) return;
+  ExtQuarters=MtcFrames(message->at(5),message->at(6),message->at(7),message->at(8))*4;
+  ExtPlaying=false; MtcRun=0; ExtTransport=MTC_LOCATE; return;
  }
- if (FollowPlay) pattpos=0; DisPattData();
+ if (message->at(0)!=MIDI_QUARTERFRAME || message->size()<2) return;
+ if (InputTime-MtcLast>MTC_TIMEOUT) { ExtPlaying=false; MtcRun=0; } //the timecode starts again
+ MtcLast=InputTime; piece=message->at(1)>>4;
+ MtcRun=(MtcRun && piece==(MtcPiece+1)%8)? MtcRun+1 : 1; MtcPiece=piece; n[piece]=message->at(1)&0xF;
+ PllInput();
+ if (ExtPlaying) ExtQuarters++;
+ if (piece==7 && MtcRun>=8)
+ { //the timecode of the last 8 pieces is that of piece 0, this one is 7 quarter-frames later
+  ExtQuarters=MtcFrames(((n[7]&7)<<4)|n[6],(n[5]<<4)|n[4],(n[3]<<4)|n[2],(n[1]<<4)|n[0])*4+7;
+  if (!ExtPlaying) { ExtPlaying=true; ExtTransport=MIDI_CONTINUE; }
+ }
+ ExtClockTicks=SDL_GetTicks();
 }
 
-
-void ContiPlay(int i)
-{
- if (SlideSpeed[i]!=0) { SlideCnt[i] += SlideSpeed[i]*16; SetPitchWheel(PLAYEDINS[i],0x2000+SlideCnt[i]);}
+void ChaseSeek(unsigned int frame)
+{ //the player goes to the frame of the timecode, the controllers are restored as after rewinding
+ KUSS(); memcpy(CHANNELS,SynthState,sizeof(CHANNELS)); TimelineStop();
+ ScanTo(frame); ChannelRestore(CHANNELS);
+ PlayedFromStart=true; if (UseTimeline) TimelineStart();
+ DisplayTime();
 }
 
-void PlayRoutine()
-{
- int h,i,j,chptn;
- unsigned char notedata,fxdata,fxvalue;
- for (h=0;h<fastfwd*ffwdspeed+1;h++)
+void ChaseFrames()
+{ //main-thread: the timecode-master located/running/stopped, then the frames its time has reached
+ unsigned char transport;
+ Uint32 elapsed;
+ double time; //ms of the tune at the timecode, interpolated between the quarter-frames
+ unsigned int target;
+ int frames;
+ if (SlaveMode!=SLAVE_MTC) return;
+ SDL_LockMutex(InputLock); //a consistent copy of the timecode, no transport lost
+ transport=ExtTransport; ExtTransport=0; elapsed=SDL_GetTicks()-ExtClockTicks;
+ time=ExtQuarters*ExtFrameLength/4-(((MtcStart[0]*60+MtcStart[1])*60+MtcStart[2])*1000+MtcStart[3]*ExtFrameLength);
+ if (ExtPlaying && ExtPeriod>0) time+=(elapsed<ExtPeriod)? elapsed : ExtPeriod; //not beyond the next quarter-frame
+ SDL_UnlockMutex(InputLock);
+ target=(time<=0)? 0 : (time/20<TIMELINE_MAXFRAMES)? (unsigned int)(time/20) : TIMELINE_MAXFRAMES;
+ if (transport)
  {
-  for (i=TrackAmount-1;i>=0;i--)  //i counts backwards: 1st channel has the priority for common effects like tempo-change
+  if (transport==MTC_LOCATE)
+  { //stopped at the position (cued)
+   if (PlayMode) { PrevPlayMode=PlayMode; PlayMode=0; FollowPlay=false; DispTrkInfo(); }
+   Chasing=false; ChaseSeek(target); ClockTransport(MIDI_STOP);
+  }
+  else
   {
-   if (EndOfTrack[i]) continue;
-   if (DELAYCNT[i]>0) {DELAYCNT[i]--; continue;}
-   if (SPDCNT[i]<=TEMPO[i]) SPDCNT[i]++; 
-   else 
-   {
-    if (PlayMode!=2) chptn=SEQUENCE[i][SEQCNT[i]]; else chptn=selpatt[i];
-    notedata=PATTERNS[chptn][0][PATTCNT[i]];
-    fxdata=PATTERNS[chptn][1][PATTCNT[i]]; fxvalue=PATTERNS[chptn][2][PATTCNT[i]];
+   FollowPlay=AutoFollow;
+   if (PlayMode==2 || !PlayedFromStart || target+MTC_WINDOW<PLAYFRAME || PLAYFRAME+MTC_WINDOW<target) ChaseSeek(target);
+   PlayMode=1; Chasing=true; DispTrkInfo(); ClockTransport(MIDI_CONTINUE);
+  }
+ }
+ if (PlayMode!=1 || !Chasing) return;
+ if (elapsed>MTC_TIMEOUT)
+ { //the quarter-frames stopped
+  PrevPlayMode=PlayMode; PlayMode=0; FollowPlay=false; Chasing=false; KUSS(); DispTrkInfo(); ClockTransport(MIDI_STOP); return;
+ }
+ if (time<0) return; //before the start of the tune
+ if (target+MTC_WINDOW<PLAYFRAME || PLAYFRAME+MTC_WINDOW<target) ChaseSeek(target); //drifted or jumped away
+ for (frames=0; frames<SLAVE_CATCHUP && PLAYFRAME<=target; frames++) { PlayRoutine(); DisplayTime(); }
+}
 
-    if (DELAYCNT[i]==-1) 
-    { 
-     if ((fxdata&0xf)==0x9) {DELAYCNT[i] = fxvalue; continue;}   //delay note by given frames, 
-     SPDCNT[i]=0;
-    }   
-    else if (DELAYCNT[i]==0) 
-    {
-     DELAYCNT[i]=-1; if (fxvalue<TEMPO[i]) SPDCNT[i]=fxvalue+1;  //but regain tempo afterwards, if possible
-    }
+//---------------------------------------------------------------------------------------------
+//------------------------------ OUTPUT SCHEDULER ---------------------------------------------
+//The messages of a frame are queued per port and sent at its end by priority: note-off, note-on, program, controllers,
+//pitch-wheel. Tracks take turns inside a class. Notes always go, the rest only while the port-budget lasts (so they
+//don't delay the notes of the next frame), the remaining ones wait for the next frame.
+#define SCHED_NOTEOFF 0
+#define SCHED_NOTEON  1
+#define SCHED_PROGRAM 2
+#define SCHED_CONTROL 3 //controllers, channel-pressure
+#define SCHED_BEND    4
+#define SCHED_CLASSES 5
+struct ScheduledMessage { unsigned char Data[3], Size, Track; unsigned int Tick; };
+std::vector<ScheduledMessage> PORTQUEUE[PortAmount][SCHED_CLASSES];
+std::vector<int> QueuedPorts; //ports having messages in their queues
+unsigned int SchedulerTick=0; //frames flushed so far, the waiting time of the messages is counted in them
+
+void QueueMessage(int port, int cls, ScheduledMessage &message)
+{ //a new value of a waiting program/controller/pitch-wheel replaces the old one (the synth would only get the last anyway)
+ unsigned int i;
+ std::vector<ScheduledMessage> &queue=PORTQUEUE[port][cls];
+ if (cls>=SCHED_PROGRAM) for (i=0;i<queue.size();i++)
+ {
+  if (queue[i].Data[0]==message.Data[0] && (cls!=SCHED_CONTROL || message.Size<3 || queue[i].Data[1]==message.Data[1]))
+  { memcpy(queue[i].Data,message.Data,3); MessagesMerged++; return; }
+ }
+ queue.push_back(message);
+}
 
+bool NoteSetting(ScheduledMessage &message)
+{ //settings the synth takes at the start of a note: program, bank, (N)RPN, pan, sound-controllers, portamento, pitch-wheel
+ unsigned char cc=message.Data[1];
+ switch (message.Data[0]&0xF0)
+ {
+  case 0xC0: case 0xE0: return true;
+  case 0xB0: return cc==0 || cc==32 || cc==6 || cc==38 || (cc>=96 && cc<=101) || cc==10 || (cc>=70 && cc<=79) || cc==84;
+  default: return false; //volume, expression, modulation, pressure... can follow the note
+ }
+}
 
-    switch (fxdata&0xF) 
-    {
-     case 0x5: UniqueCC(PLAYEDINS[i],73,fxvalue); //Attack
-            break;
-     case 0x6: UniqueCC(PLAYEDINS[i],75,fxvalue); //Decay
-            break;
-     case 0x7: UniqueCC(PLAYEDINS[i],72,fxvalue); //Release
-            break;
-     case 0x8: UniqueCC(PLAYEDINS[i],76,fxvalue); //Vibrato Rate
-            break;
-     
-     case 0xA: SetVolume(PLAYEDINS[i],fxvalue);
-            break;
-     case 0xB: SmallCCFX(PLAYEDINS[i],fxvalue);
-            break;
-     case 0xC: PLAYEDINS[i]=fxvalue; SelectIns(fxvalue); DispTrkInfo();
-            break;
-     case 0xD: SetAfterTouch(PLAYEDINS[i],fxvalue);
-            break;
-     case 0xE: SetPitchWheel(PLAYEDINS[i],fxvalue*64); SlideSpeed[i]=SlideCnt[i]=0;
-            break;
-     case 0xF: if (fxvalue<0x80) for(j=0;j<TrackAmount;j++) { TEMPO[j]=fxvalue; } //SPDCNT[j]=TEMPO[j];}
-               else { TEMPO[i]=fxvalue&0x7f; } //SPDCNT[i]=TEMPO[i];}
-            break;
-     default: break;
-    }
-    
-    if (notedata>0)
-    { 
-     if (notedata<NOTE_MAX)
-     { 
-      if (prevnote[i]>0) NoteOff(PLAYEDINS[i],prevnote[i],0x0); 
-      if (mutesolo[i]) { NoteOn(PLAYEDINS[i],notedata,((fxdata/16-1)&0xF)*8); prevnote[i]=notedata; }
-      if (Vibrato[i]) {UniqueCC(PLAYEDINS[i],01,0x00); Vibrato[i]=false;} //new note resets Modulation wheel (Vibrato Amplitude)
-      if (SlideSpeed[i]!=0 || SlideCnt[i]!=0) {SetPitchWheel(PLAYEDINS[i],0x2000); SlideSpeed[i]=SlideCnt[i]=0;}
-     }
-     else if (notedata==GATEOFF_NOTEFX && prevnote[i]>0) NoteOff(PLAYEDINS[i],prevnote[i],0x0); 
-     else if (mutesolo[i] && notedata==GATEON_NOTEFX) NoteOn(PLAYEDINS[i],prevnote[i],((fxdata/16-1)&0xF)*8); 
-    }
-    
-    switch (fxdata&0xF) //After-effects
+void ScheduleMessage(int port)
+{ //split PlayerMessage into single messages and queue them by priority
+ ScheduledMessage message;
+ unsigned int i=0,j;
+ int cls,k;
+ bool queued=false;
+ for (k=0;k<SCHED_CLASSES;k++) if (PORTQUEUE[port][k].size()) queued=true;
+ if (!queued && PlayerMessage.size()) QueuedPorts.push_back(port);
+ while (i<PlayerMessage.size())
+ {
+  message.Size=((PlayerMessage.at(i)&0xE0)==0xC0)? 2 : 3; if (i+message.Size>PlayerMessage.size()) message.Size=PlayerMessage.size()-i;
+  memset(message.Data,0,3); for (j=0;j<message.Size;j++) message.Data[j]=PlayerMessage.at(i+j);
+  message.Track=CurrentTrack; message.Tick=SchedulerTick; i+=message.Size;
+  switch (message.Data[0]&0xF0)
+  {
+   case 0x80: cls=SCHED_NOTEOFF; break;
+   case 0x90: cls=(message.Data[2])? SCHED_NOTEON : SCHED_NOTEOFF; break;
+   case 0xC0: cls=SCHED_PROGRAM; break;
+   case 0xE0: cls=SCHED_BEND; break;
+   default: cls=SCHED_CONTROL; break;
+  }
+  if (cls==SCHED_NOTEON)
+  { //settings of the channel queued before its note that it starts with have to arrive before it
+   for (k=SCHED_PROGRAM;k<SCHED_CLASSES;k++)
+   {
+    std::vector<ScheduledMessage> &queue=PORTQUEUE[port][k];
+    for (j=0;j<queue.size();)
     {
-     case 0x1: SlideSpeed[i]=fxvalue;
-            break;
-     case 0x2: SlideSpeed[i]=fxvalue*-1;
-            break;
-     case 0x3: SetPortamento(PLAYEDINS[i],fxvalue);
-            break;
-     case 0x4: UniqueCC(PLAYEDINS[i],01,fxvalue); Vibrato[i]=true; //Modulation wheel (Vibrato Amplitude)
-            break;
-     default: break;
+     if ((queue[j].Data[0]&0xF)==(message.Data[0]&0xF) && NoteSetting(queue[j])) { PORTQUEUE[port][SCHED_NOTEON].push_back(queue[j]); queue.erase(queue.begin()+j); }
+     else j++;
     }
+   }
+  }
+  else if (cls==SCHED_NOTEOFF)
+  { //a note-off after a note-on of the same key stays after it
+   std::vector<ScheduledMessage> &queue=PORTQUEUE[port][SCHED_NOTEON];
+   for (j=0;j<queue.size();j++) if ((queue[j].Data[0]&0x0F)==(message.Data[0]&0x0F) && (queue[j].Data[0]&0xF0)==0x90 && queue[j].Data[1]==message.Data[1]) cls=SCHED_NOTEON;
+  }
+  QueueMessage(port,cls,message);
+ }
+}
 
-    if (!FollowPlay) DisPattCnt(i);
+int Log2Bucket(unsigned int value)
+{ //histogram-bucket of a value
+ int bucket=0;
+ while (value && bucket<HISTOGRAM_SIZE-1) { value/=2; bucket++; }
+ return bucket;
+}
 
-    if (PATTCNT[i]<PATTLENG[chptn]-1) PATTCNT[i]++;
-    else 
+void ScheduleFlush()
+{ //end of a frame: send the queued messages of the ports by priority, tracks taking turns
+ std::vector<unsigned char> data;
+ std::vector<int> ports;
+ unsigned int i,j,depth,wire;
+ int cls,track,port,p;
+ SchedulerTick++;
+ memset(BudgetUsed,0,sizeof(BudgetUsed));
+ for (p=0;p<(int)QueuedPorts.size();p++)
+ {
+  port=QueuedPorts[p]; depth=0;
+  for (cls=0;cls<SCHED_CLASSES;cls++) depth+=PORTQUEUE[port][cls].size();
+  QueueDepthHist[Log2Bucket(depth)]++; depth=0;
+  for (cls=0;cls<SCHED_CLASSES;cls++)
+  {
+   std::vector<ScheduledMessage> &queue=PORTQUEUE[port][cls], waiting;
+   for (i=0;i<TrackAmount;i++)
+   {
+    track=(i+SchedulerTick)%TrackAmount; //rotating start: no track is always the last one
+    for (j=0;j<queue.size();j++) if (queue[j].Track==track)
     {
-     PATTCNT[i]=0; 
-     if (PlayMode!=2) //check if pattern-play mode
-     {
-      SEQCNT[i]++; 
-      if (SEQUENCE[i][SEQCNT[i]]==ORDERLIST_FX_JUMP) 
-      {
-       if (ExportMode) EndOfTrack[i]=true;
-       else SEQCNT[i]=SEQUENCE[i][SEQCNT[i]+1];
-      }
-      else if (SEQUENCE[i][SEQCNT[i]]==ORDERLIST_FX_END) EndOfTrack[i]=true;
-      if (FollowPlay && !EndOfTrack[i]) 
-      { 
-       if (SEQUENCE[i][SEQCNT[i]]<ORDERLIST_FX_MIN) 
-       {
-        selpatt[i]=SEQUENCE[i][SEQCNT[i]]; pattpos=0;
-       }
-      }
+     if (cls>SCHED_NOTEON && PortBudget[port] && BudgetUsed[port]+queue[j].Size>PortBudget[port]) { waiting.push_back(queue[j]); continue; }
+     data.assign(queue[j].Data,queue[j].Data+queue[j].Size);
+     PortSend(port,&data);
+     BudgetUsed[port]+=queue[j].Size;
+     if (cls<=SCHED_NOTEON)
+     { //latency of notes: frames waited + time on the cable behind the bytes sent before
+      wire=(PortBudget[port])? BudgetUsed[port]*20/PortBudget[port] : 0;
+      NoteLatencyHist[Log2Bucket((SchedulerTick-1-queue[j].Tick)*20+wire)]++;
      }
-     else if (FollowPlay) pattpos=0;
-     DispSeqCnt(i);
     }
-
-   } //SPDCNT
-   ContiPlay(i);
-  } //i
-  
-  EndOfTune=true; for (i=0;i<TrackAmount;i++) if (!EndOfTrack[i]) EndOfTune=false;
-  if (EndOfTune && FollowPlay) {FollowPlay=false; DisPattData();}
-  
-  if (FollowPlay && SPDCNT[WinPos1[0]+TrkPos]==0 && !EndOfTune) 
-  {
-   if (PATTCNT[WinPos1[0]+TrkPos] >= PattDimY/2 && PATTCNT[WinPos1[0]+TrkPos]-1 < PATTLENG[selpatt[WinPos1[0]+TrkPos]]-PattDimY/2) 
-   {
-    pattpos=PATTCNT[WinPos1[0]+TrkPos]-PattDimY/2; WinPos2[0]=PattDimY/2-1;
-   }
-   else 
-   { 
-    if (PATTCNT[WinPos1[0]+TrkPos] < PattDimY/2) pattpos=0; 
-    else pattpos=PATTLENG[selpatt[WinPos1[0]+TrkPos]]-PattDimY;
-    WinPos2[0]=(PATTCNT[WinPos1[0]+TrkPos]-pattpos)-1;
    }
-   if (WinPos2[0]<0) WinPos2[0]=0; //safety check
-   if (WinPos2[0]>=PattDimY) WinPos2[0]=PattDimY-1; //safety check
-   DisPattData();
+   queue.swap(waiting); depth+=queue.size();
   }
-  
+  if (depth>0) ports.push_back(port); //still has waiting messages
  }
- 
+ QueuedPorts.swap(ports);
 }
 
 //**********************************************************************************************
@@ -779,38 +2540,254 @@ Uint32 timerCallback(Uint32 interval, void *param)
   return interval;
 }
 
+Uint32 blinkCallback(Uint32 interval, void *param)
+{
+  SDL_Event event;
+  event.type = SDL_USEREVENT;
+  event.user.code = BLINKEVENT_CODE;
+  event.user.data1 = event.user.data2 = NULL;
+  SDL_PushEvent(&event);
+  return interval;
+}
+
 void SetTimer()
 {
+ memcpy(KeyState,SDL_GetKeyState(NULL),SDLK_LAST); //keys pressed/released while a dialog read them
+ if (TimersOn) return;
  FrameClk = SDL_AddTimer(TimerInterval, timerCallback,NULL);
+ BlinkClk = SDL_AddTimer(CURSOR_BLINK, blinkCallback,NULL);
+ TimersOn=true; Sleeping=false; IdleFrames=0;
 }
 
 void RemoveTimer()
+{ //a timer-event queued already is skipped (TimersOn/Sleeping), no need to wait for it
+ if (!TimersOn) return;
+ SDL_RemoveTimer(FrameClk); SDL_RemoveTimer(BlinkClk); TimersOn=false;
+}
+
+bool Busy()
+{ //anything for the frames to do: playback/following, held keys, background-work, messages to send
+ int i;
+ bool launches;
+ SDL_LockMutex(InputLock); launches=(LaunchInboxIn!=LaunchInboxOut); SDL_UnlockMutex(InputLock);
+ if (PlayMode>0 || SlaveMode || Overlay || QueuedPorts.size() || launches) return true;
+ for (i=0;i<SDLK_LAST;i++) if (KeyState[i] && i!=SDLK_NUMLOCK && i!=SDLK_CAPSLOCK && i!=SDLK_SCROLLOCK) return true; //auto-repeat (locks stay 'down' while on)
+ if (!TimelineDone) return true;
+ if (LibraryRoots.size() && (LibraryDir || LibraryFolders.size() || LibraryPending.size() || LibraryScanning || LibraryDirty || LibraryQueued)) return true;
+ if ((SetlistPos>=0 && NextLoaded<0 && SetlistChecked!=SetlistPos) || SetlistReading>=0) return true;
+ return false;
+}
+
+void IdleSleep()
+{ //stopped and nothing to do: no timers, the main loop blocks till the next key/mouse/window-event or MIDI-input
+ CurColor=256-32; ColDir=1; DispCursor(); //left lit
+ RemoveTimer(); Sleeping=true;
+}
+
+void IdleWake()
 {
- SDL_RemoveTimer(FrameClk);
- SDL_Delay(20);
+ SetTimer();
 }
 
+//------------------------------ PLAYER-THREAD ------------------------------------------------
+//The frames of the player run on their own thread by the wall-clock, so the dialogs, the file-selector and the
+//song-library browser don't have to drive them. The player-state is guarded by PlayerLock: the main thread has it
+//all the time except while it waits for events (EventWait, the dialogs), the player-thread takes it for its frames.
+//The screen belongs to the main thread: what the player-thread would draw is flagged and drawn at the next frame-tick.
+bool DrawLater(int part)
+{ //called by the display-routines: on the player-thread only the flag is set
+ if (!InPlayer) return false;
+ PlayerRedraw|=part; return true;
+}
 
-void DisplayTime()
+void PlayerShow()
+{ //main thread: the parts of the screen the player-thread changed
+ int i, parts=PlayerRedraw;
+ PlayerRedraw=0;
+ if (parts&REDRAW_ALL) Display();
+ else
+ {
+  if (parts&REDRAW_PATTERN) DisPattData();
+  if (parts&REDRAW_COUNTERS) for (i=0;i<TrackAmount;i++) { DisPattCnt(i); DispSeqCnt(i); }
+  if (parts&REDRAW_TRACKINFO) DispTrkInfo();
+ }
+ if (parts&REDRAW_TIME) DisplayTime();
+}
+
+bool PlayerIdle()
+{ //nothing for the frames: the player-thread waits till the main thread or the MIDI-input signals
+ bool launches;
+ SDL_LockMutex(InputLock); launches=(LaunchInboxIn!=LaunchInboxOut); SDL_UnlockMutex(InputLock);
+ return PlayMode==0 && !SlaveMode && !QueuedPorts.size() && !launches;
+}
+
+void PlayerFrame()
+{ //a 20ms frame of the player-thread
+ LaunchInput(); //pattern-launches of the MIDI-input
+ if (PlayMode>0) { if (!SlaveMode || PlayMode!=1) {PlayRoutine();DisplayTime();} } //a slave plays the tune when the master's clocks (timecode) tell
+ else ScheduleFlush(); //messages left over from the last frames of playback
+}
+
+int PlayerLoop(void *unused)
+{ //player-thread: the frames on their 20ms, the clock-slave/timecode-chase as soon as the MIDI-input wakes it
+ Uint32 now; Sint32 wait; bool idle=true;
+ SDL_LockMutex(PlayerLock);
+ while (!PlayerQuit)
+ {
+  now=SDL_GetTicks(); InPlayer=true;
+  if (idle) PlayerTicks=now; //the first frame at once after a stop
+  else if ((Sint32)(now-PlayerTicks)>PLAYER_CATCHUP*TimerInterval) PlayerTicks=now-PLAYER_CATCHUP*TimerInterval; //no burst after a long hold-up
+  while ((Sint32)(now-PlayerTicks)>=0) { PlayerFrame(); PlayerTicks+=TimerInterval; }
+  LoopService();
+  InPlayer=false; idle=PlayerIdle();
+  if (idle) SDL_CondWait(PlayerSignal,PlayerLock);
+  else if ((wait=PlayerTicks-SDL_GetTicks())>0) SDL_CondWaitTimeout(PlayerSignal,PlayerLock,wait);
+ }
+ SDL_UnlockMutex(PlayerLock);
+ return 0;
+}
+
+void PlayerStart()
+{ //the main thread keeps the lock till it waits for events
+ PlayerLock=SDL_CreateMutex(); PlayerSignal=SDL_CreateCond(); SDL_LockMutex(PlayerLock);
+ PlayerThread=SDL_CreateThread(PlayerLoop,NULL);
+}
+
+void PlayerStop()
 {
- Uint32 diff=SDL_GetTicks()-StartTime;
- Uint32 Minutes=diff/(1000*60), Seconds=((diff-Minutes)/1000)%60;
+ PlayerQuit=true; SDL_CondSignal(PlayerSignal); SDL_UnlockMutex(PlayerLock);
+ SDL_WaitThread(PlayerThread,NULL); PlayerThread=NULL;
+}
+
+void PlayerRelease()
+{ //the main thread is about to wait: the player-thread gets the lock, woken for what the main thread changed (play, stop, preview)
+ SDL_CondSignal(PlayerSignal); SDL_UnlockMutex(PlayerLock);
+}
+
+int EventWait(SDL_Event *ev)
+{ //the next event for the main thread: polled every millisecond (SDL_WaitEvent() looks only every 10ms), blocking only while sleeping
+ int got;
+ PlayerRelease();
+ if (Sleeping) got=SDL_WaitEvent(ev);
+ else while (!(got=SDL_PollEvent(ev))) SDL_Delay(1);
+ SDL_LockMutex(PlayerLock);
+ return got;
+}
+
+
+void DisplayTime()
+{ //tune-time (follows fast-forward/rewind too) instead of elapsed wall-clock time
+ if (Overlay || DrawLater(REDRAW_TIME)) return;
+ Uint32 Minutes=PLAYFRAME/(50*60), Seconds=(PLAYFRAME/50)%60;
  put2digit (6,StatPosY,Minutes);  put2digit (9,StatPosY,Seconds);
  SDL_UpdateRect(screen, (6)*CharSizeX, StatPosY*CharSizeY, 5*CharSizeX,CharSizeY);
 }
 
+void PutFrameTime(int x, int y, unsigned int frame)
+{ //mm:ss of a frame, --:-- if not known
+ if (frame==TIMELINE_UNKNOWN) { PutString(x,y,"--:--"); return; }
+ put2digit(x,y,frame/(50*60)); PutString(x+2,y,":"); put2digit(x+3,y,(frame/50)%60);
+}
+
+void DispTiming()
+{ //time of the orderlist-position under the cursor and length of the tune from the timing-index, redrawn only on change
+ if (Overlay) return;
+ static unsigned int ShownPos=0, ShownLength=0;
+ unsigned int pos=PositionFrame(WinPos2[1]+TrkPos,seqpos+WinPos1[1]), length=TuneLength();
+ if (pos==ShownPos && length==ShownLength) return;
+ ShownPos=pos; ShownLength=length;
+ PutFrameTime(InstPosX-2,InstPosY+InsDimY+1,pos); PutString(InstPosX+3,InstPosY+InsDimY+1,"/"); PutFrameTime(InstPosX+4,InstPosY+InsDimY+1,length);
+ SDL_UpdateRect(screen, (InstPosX-2)*CharSizeX, (InstPosY+InsDimY+1)*CharSizeY, 11*CharSizeX,CharSizeY);
+}
+
+
+void FrameTick()
+{ //timer-event of the main loop (and of the open dialogs): keys, the screen of the player-thread, background-work
+ static int PortChkTimer=0; const int PortChkPeriod=100;
+ int i;
+ if (!INSTRUMENT[SelInst][0] && !INSTRUMENT[SelInst][1] && !INSTRUMENT[SelInst][2]) DispNote=0; //avoid loopback/feedback at least for empty instruments
+ /*if (MIDIselInst!=0xFF) //selecting instrument through MIDI-input? - on Linux Midi-thourgh causes loop
+ {
+  SelInst=MIDIselInst; SelectIns(SelInst); DispInstr(); MIDIselInst=0xFF;
+ }*/
+ PlayerShow(); //what the player-thread played since the last tick
+ if (!Overlay) KeyHandler(); //an open dialog reads the keys itself
+ TimelineBackground(); //compile ahead (timeline-playback, timing-index)
+ LibraryBackground(); //index the song-library
+ SetlistBackground(); //preload the next tune of the setlist
+ DispTiming();
+ DispMIDIevent();
+ if (PortChkTimer--<=0)
+ {
+  PortChkTimer=PortChkPeriod; i=midiin->getPortCount();
+  if (InPortCount!=i) //check if change happened meanwhile
+  {
+   SetInDevice(UsedInPort); //if MIDI controller connected/disconnected, refresh callback & display 
+   DisplaySettings();
+  }
+  InPortCount=i;
+ }
+ if (Busy()) IdleFrames=0; else if (++IdleFrames>=IDLE_FRAMES) IdleSleep();
+}
+
+void LoopService()
+{ //every round of the player-thread (woken by the MIDI-input too)
+ SlaveFrames(); ChaseFrames(); //clock-slave / timecode-chase playback
+}
+
+int OverlayTake(SDL_Event *ev)
+{ //an event under a dialog: the timer- and wake-events are handled here, the other ones are the dialog's (1)
+ if (ev->type==SDL_USEREVENT && ev->user.code==TIMEREVENT_CODE) { if (TimersOn) FrameTick(); }
+ else if (ev->type==SDL_USEREVENT && ev->user.code==BLINKEVENT_CODE) ;
+ else if (ev->type==SDL_USEREVENT && ev->user.code==WAKEEVENT_CODE) { WakeTaken(); if (Sleeping) IdleWake(); }
+ else { if (Sleeping) IdleWake(); return 1; }
+ return 0;
+}
+
+int OverlayPoll(SDL_Event *ev)
+{ //event-polling of the dialogs reading the key-states: the next event of the dialog (1), or 0 if none left
+ while (SDL_PollEvent(ev)) if (OverlayTake(ev)) return 1;
+ return 0;
+}
+
+void OverlayEvent(SDL_Event *ev)
+{ //blocking event-wait of the dialogs, the player-thread plays meanwhile
+ while (EventWait(ev)) if (OverlayTake(ev)) return;
+ ev->type=SDL_NOEVENT;
+}
+
+void OverlayWait(int ms)
+{ //instead of SDL_Delay() in the dialogs: the player-thread plays meanwhile, the input-events are left for the dialog
+ SDL_Event ev;
+ PlayerRelease(); SDL_Delay(ms); SDL_LockMutex(PlayerLock);
+ SDL_PumpEvents();
+ while (SDL_PeepEvents(&ev,1,SDL_GETEVENT,SDL_EVENTMASK(SDL_USEREVENT))>0)
+ {
+  if (ev.user.code==TIMEREVENT_CODE && TimersOn) FrameTick();
+  else if (ev.user.code==WAKEEVENT_CODE) WakeTaken();
+ }
+}
+
+void OverlayOpen()
+{ //a dialog covers the screen: the player runs on without drawing, the keys go to the dialog
+ Overlay++;
+}
+
+void OverlayClose()
+{
+ if (Overlay>0) Overlay--;
+ memcpy(KeyState,SDL_GetKeyState(NULL),SDLK_LAST); RepeatTime=0; RepeatKey=0; //the keys used in the dialog aren't taken by the key-handler
+}
+
 
 //=================================================================================================
 //------------------------------------Key/Mouse-handling functions--------------------------------
 int repeatex()
-{
- static int prevkey;
- //SDL_PollEvent(&event);
- //if (event.type==SDL_KEYDOWN ) { if (prevkey!=event.key.keysym.sym) repecnt=repspd1;}
- //prevkey=event.key.keysym.sym; 
- if (repecnt==repspd1) { repecnt--; return 0; }
- else if (repecnt==0) {repecnt=repspd2; return 0; }
- else {repecnt--; return 1;}
+{ //0 when the held key should act: at once, then after repspd1 and every repspd2 (by wall-clock, not by frames)
+ Uint32 now=SDL_GetTicks();
+ if (RepeatTime==0) { RepeatTime=now+repspd1*TimerInterval; if (!RepeatTime) RepeatTime=1; return 0; }
+ else if ((Sint32)(now-RepeatTime)>=0) { RepeatTime+=repspd2*TimerInterval; if ((Sint32)(now-RepeatTime)>=0) RepeatTime=now+repspd2*TimerInterval; return 0; }
+ else return 1;
 }
 
 void CurLeft()
@@ -913,7 +2890,7 @@ void SoloUnsolo(int track)
    if (i!=track) 
    {
     SoloState=true; mutesolo[i]=false;
-    if (prevnote[i]>0) NoteOff(PLAYEDINS[i],prevnote[i],0);
+    TrackNotesOff(i);
    }
    else mutesolo[i]=true;
   }
@@ -927,21 +2904,35 @@ void SoloUnsolo(int track)
 
 //-------------------------------------
 bool SHIFTstate,CTRLstate,ALTstate;
+bool KeyModifier(int key)
+{ //shift/ctrl/alt/meta/locks: they only change the other keys
+ return key>=SDLK_NUMLOCK && key<=SDLK_MODE;
+}
+
 void KeyHandler()
 {
- int i,j;
+ int i,j,k;
  //int mouseX, mouseY;
  //Uint8 mousebutt;
  
- SDL_PumpEvents();
- keystate = SDL_GetKeyState(NULL);
+ memset(KeyDispatch,0,SDLK_LAST); for (i=SDLK_NUMLOCK;i<=SDLK_MODE;i++) KeyDispatch[i]=KeyState[i]; //the modifiers, updated by the key-events as they arrive
+ if (RepeatKey) KeyDispatch[RepeatKey]=KeyState[RepeatKey]; //the key of the event (or the held one repeating), not the others held
+ keystate = KeyDispatch;
  //mousebutt= SDL_GetMouseState(&mouseX, &mouseY);
  SHIFTstate = (keystate[SDLK_LSHIFT] || keystate[SDLK_RSHIFT]);
  CTRLstate = (keystate[SDLK_LCTRL] || keystate[SDLK_RCTRL]);
  ALTstate = (keystate[SDLK_LALT] || keystate[SDLK_RALT]);
  
  //continuous-response keys
- if (keystate[SDLK_LEFT]||keystate[SDLK_RIGHT]||keystate[SDLK_UP]||keystate[SDLK_DOWN])
+ if (ALTstate && Window==0 && (keystate[SDLK_LEFT]||keystate[SDLK_RIGHT]))
+ { //select the note-column shown/edited in the pattern-editor
+  if (repeatex()==0) { NoteColumn=(NoteColumn+((keystate[SDLK_RIGHT])?1:PtnNoteColumns-1))%PtnNoteColumns; DisPattData(); }
+ }
+ else if (ALTstate && Window==2 && (keystate[SDLK_LEFT]||keystate[SDLK_RIGHT]))
+ { //select the instrument-fields shown/edited in the instrument-window
+  if (repeatex()==0) { InstPage=(InstPage+((keystate[SDLK_RIGHT])?1:InstPages-1))%InstPages; DispInstr(); }
+ }
+ else if (keystate[SDLK_LEFT]||keystate[SDLK_RIGHT]||keystate[SDLK_UP]||keystate[SDLK_DOWN])
  {
   if(keystate[SDLK_LEFT]) KeyLeft();
   if(keystate[SDLK_RIGHT]) KeyRight();
@@ -950,7 +2941,17 @@ void KeyHandler()
  }
  else if(keystate[SDLK_F5])
  {
-  if (repeatex()==0) { Window=0;Display(); }
+  if (repeatex()==0) 
+  {
+   if (ALTstate) 
+   { //follow the clock, the timecode or neither of the MIDI-input
+    SDL_LockMutex(InputLock);
+    SlaveMode=(SlaveMode+1)%3; midiin->ignoreTypes(SlaveMode!=SLAVE_MTC,!SlaveMode,true); 
+    PllTime=PllPeriod=ExtPeriod=ExtJitter=0; ExtPlaying=Chasing=false; ExtTransport=0;
+    SDL_UnlockMutex(InputLock); DisplaySettings(); return; 
+   }
+   Window=0;Display(); 
+  }
  }
  else if(keystate[SDLK_F6])
  {
@@ -969,8 +2970,9 @@ void KeyHandler()
    {
     if (Window==0)
     { //play patterns from cursor-position
-     for(i=0;i<TrackAmount;i++) { PATTCNT[i]=pattpos+WinPos2[0]; SPDCNT[i]=0; }
-     PlayMode=2; StartTime=SDL_GetTicks();
+     for(i=0;i<TrackAmount;i++) { PATTCNT[i]=pattpos+WinPos2[0]; SPDCNT[i]=TRACKWAIT[i]=0; }
+     TimelineStop(); PlayedFromStart=false; PLAYFRAME=0; PlayMode=2; StartTime=SDL_GetTicks();
+     CLOCKPOS=((unsigned long long)(pattpos+WinPos2[0])*24*65536)/((ROWSPERBEAT[0])?ROWSPERBEAT[0]:defrowsperbeat); ClockTransport(MIDI_CONTINUE);
     }
     else if (Window==1) 
     { //set marker for F2 playback
@@ -1057,13 +3059,14 @@ void KeyHandler()
   {
    if (Window==0)
    {
-    if (CTRLstate) {PATTLENG[selpatt[WinPos1[0]+TrkPos]]=WinPos2[0]+pattpos; DisPattData();}
-    else if (WinPos3[0]==0 && KeyMode==1 && !FollowPlay) { PATTERNS [selpatt[WinPos1[0]+TrkPos]] [0] [WinPos2[0]+pattpos] = (!SHIFTstate)?GATEOFF_NOTEFX:GATEON_NOTEFX; CursorAdvance();DisPattData(); }
-    else if (WinPos3[0]>=2 && (PATTERNS [selpatt[WinPos1[0]+TrkPos]] [1] [WinPos2[0]+pattpos] &0xF) == 0xC ) 
+    if (CTRLstate) {PATTLENG[selpatt[WinPos1[0]+TrkPos]]=WinPos2[0]+pattpos; DirtyPattern(selpatt[WinPos1[0]+TrkPos]); DisPattData();}
+    else if (WinPos3[0]==0 && KeyMode==1 && !FollowPlay) { PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PtnNoteColumn[NoteColumn]] = (!SHIFTstate)?GATEOFF_NOTEFX:GATEON_NOTEFX; DirtyPattern(selpatt[WinPos1[0]+TrkPos]); CursorAdvance();DisPattData(); }
+    else if (WinPos3[0]>=2 && (PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PTN_FX] &0xF) == 0xC ) 
     { 
-     SelInst=PATTERNS [selpatt[WinPos1[0]+TrkPos]] [2] [WinPos2[0]+pattpos]; SelectIns(SelInst); Window=2; Display();
+     SelInst=PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PTN_FXVALUE]; SelectIns(SelInst); Window=2; Display();
     } 
    }
+   else if (Window==2) { DisplayGMset(); InitGUI(); } //show General MIDI instrument set
    else if (Window==1) 
    { 
     SetSelPatt();
@@ -1079,10 +3082,11 @@ void KeyHandler()
    {
     if (!FollowPlay)
     { 
-     if (WinPos3[0]==0) PATTERNS [selpatt[WinPos1[0]+TrkPos]] [0] [WinPos2[0]+pattpos] = 0; 
-     else if (WinPos3[0]==1) PATTERNS [selpatt[WinPos1[0]+TrkPos]] [1] [WinPos2[0]+pattpos] &= 0x0F;
-     else if (WinPos3[0]>=2) { PATTERNS [selpatt[WinPos1[0]+TrkPos]] [1] [WinPos2[0]+pattpos] &= 0xF0; PATTERNS [selpatt[WinPos1[0]+TrkPos]] [2] [WinPos2[0]+pattpos] = 0; } 
-     if (CTRLstate) { for (i=0;i<=2;i++) PATTERNS [selpatt[WinPos1[0]+TrkPos]] [i] [WinPos2[0]+pattpos] = 0; }
+     if (WinPos3[0]==0) PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PtnNoteColumn[NoteColumn]] = 0; 
+     else if (WinPos3[0]==1) PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PTN_FX] &= 0x0F;
+     else if (WinPos3[0]>=2) { PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PTN_FX] &= 0xF0; PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PTN_FXVALUE] = 0; } 
+     if (CTRLstate) memset(PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos],0,PtnColumns); //the whole row with all note-columns
+     DirtyPattern(selpatt[WinPos1[0]+TrkPos]);
      if (!SHIFTstate) CurUp(); else CursorAdvance(); 
      DisPattData(); 
     }
@@ -1090,7 +3094,7 @@ void KeyHandler()
    if (Window==1) 
    { 
     //SEQUENCE [WinPos2[1]+TrkPos] [seqpos+WinPos1[1]] &= (WinPos3[1])?0xF0:0x0F; if (!SHIFTstate) CurLeft(); else CurRight(); DispOrderL();
-    SEQUENCE [WinPos2[1]+TrkPos] [seqpos+WinPos1[1]] = ORDERLIST_FX_END; 
+    SEQUENCE [WinPos2[1]+TrkPos] [seqpos+WinPos1[1]] = ORDERLIST_FX_END; DirtySequence(WinPos2[1]+TrkPos,seqpos+WinPos1[1]);
     if (!SHIFTstate) {CurLeft();CurLeft();} else {CurRight();CurRight();}  DispOrderL();
    }
   }
@@ -1108,22 +3112,22 @@ void KeyHandler()
      {
       for(j=WinPos2[0]+pattpos;j<PATTLENG[selpatt[WinPos1[0]+TrkPos]]-1;j++) 
       { 
-       PATTERNS [selpatt[WinPos1[0]+TrkPos]] [i] [j] = PATTERNS [selpatt[WinPos1[0]+TrkPos]] [i] [j+1]; 
+       PATTERNS [selpatt[WinPos1[0]+TrkPos]] [j] [i] = PATTERNS [selpatt[WinPos1[0]+TrkPos]] [j+1] [i]; 
       }
-      PATTERNS [selpatt[WinPos1[0]+TrkPos]] [i] [j] = 0 ;
+      PATTERNS [selpatt[WinPos1[0]+TrkPos]] [j] [i] = 0 ;
      }
      else
      {
-      PATTERNS [selpatt[WinPos1[0]+TrkPos]] [(WinPos3[0]==0)?0:1] [WinPos2[0]+pattpos] = 0;
-      if (CTRLstate) { for(i=0;i<=2;i++) PATTERNS [selpatt[WinPos1[0]+TrkPos]] [i] [WinPos2[0]+pattpos] = 0; }
+      PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [(WinPos3[0]==0)? PtnNoteColumn[NoteColumn] : PTN_FX] = 0;
+      if (CTRLstate) memset(PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos],0,PtnColumns);
      }
-     DisPattData(); //printf("$%2x\n",PATTLENG[selpatt[WinPos1[0]+TrkPos]]);
+     DirtyPattern(selpatt[WinPos1[0]+TrkPos]); DisPattData(); //printf("$%2x\n",PATTLENG[selpatt[WinPos1[0]+TrkPos]]);
     }
    }
    else if (Window==1)
    {
     for (i=seqpos+WinPos1[1];i<MaxSeqLength-1;i++) SEQUENCE[WinPos2[1]+TrkPos][i] = SEQUENCE[WinPos2[1]+TrkPos][i+1];    SEQUENCE[WinPos2[1]+TrkPos][i]=ORDERLIST_FX_END;  
-    DispOrderL();
+    DirtySequence(WinPos2[1]+TrkPos,seqpos+WinPos1[1]); DispOrderL();
    }
   }
  }
@@ -1139,17 +3143,17 @@ void KeyHandler()
      {
       for(j=PATTLENG[selpatt[WinPos1[0]+TrkPos]]-1;j>=WinPos2[0]+pattpos;j--) 
       { 
-       PATTERNS [selpatt[WinPos1[0]+TrkPos]] [i] [j+1] = PATTERNS [selpatt[WinPos1[0]+TrkPos]] [i] [j]; 
+       PATTERNS [selpatt[WinPos1[0]+TrkPos]] [j+1] [i] = PATTERNS [selpatt[WinPos1[0]+TrkPos]] [j] [i]; 
       }
-      PATTERNS [selpatt[WinPos1[0]+TrkPos]] [i] [j+1] = 0 ;
+      PATTERNS [selpatt[WinPos1[0]+TrkPos]] [j+1] [i] = 0 ;
      }
-     DisPattData();
+     DirtyPattern(selpatt[WinPos1[0]+TrkPos]); DisPattData();
     }
    }
    else if (Window==1)
    {
     for (i=MaxSeqLength-2;i>=seqpos+WinPos1[1];i--) SEQUENCE[WinPos2[1]+TrkPos][i+1] = SEQUENCE[WinPos2[1]+TrkPos][i];    SEQUENCE[WinPos2[1]+TrkPos][i+1]=0; //0xff;  
-    DispOrderL();
+    DirtySequence(WinPos2[1]+TrkPos,seqpos+WinPos1[1]); DispOrderL();
    }
   }
  }
@@ -1164,12 +3168,12 @@ void KeyHandler()
     {
      for (i=0;i<1+11*!SHIFTstate;i++)
      {
-      for (j=WinPos2[0]+pattpos;j<PATTLENG[selpatt[WinPos1[0]+TrkPos]]; j++)
+      for (j=WinPos2[0]+pattpos;j<PATTLENG[selpatt[WinPos1[0]+TrkPos]]; j++) for (k=0;k<PtnNoteColumns;k++)
       {  
-       if ( (PATTERNS [selpatt[WinPos1[0]+TrkPos]] [0] [j] & 0x7f) > 1 && (PATTERNS [selpatt[WinPos1[0]+TrkPos]] [0] [j] &0x7f) <= NOTE_MAX ) PATTERNS [selpatt[WinPos1[0]+TrkPos]] [0] [j] -= 1;
+       if ( (PATTERNS [selpatt[WinPos1[0]+TrkPos]] [j] [PtnNoteColumn[k]] & 0x7f) > 1 && (PATTERNS [selpatt[WinPos1[0]+TrkPos]] [j] [PtnNoteColumn[k]] &0x7f) <= NOTE_MAX ) PATTERNS [selpatt[WinPos1[0]+TrkPos]] [j] [PtnNoteColumn[k]] -= 1;
       }
      }
-     DisPattData();
+     DirtyPattern(selpatt[WinPos1[0]+TrkPos]); DisPattData();
     }
    }
   }
@@ -1185,13 +3189,13 @@ void KeyHandler()
     {
      for (i=0;i<1+11*!SHIFTstate;i++)
      {
-      for (j=WinPos2[0]+pattpos;j<PATTLENG[selpatt[WinPos1[0]+TrkPos]]; j++)
+      for (j=WinPos2[0]+pattpos;j<PATTLENG[selpatt[WinPos1[0]+TrkPos]]; j++) for (k=0;k<PtnNoteColumns;k++)
       {  
-       if ( (PATTERNS [selpatt[WinPos1[0]+TrkPos]] [0] [j] &0x7f) && (PATTERNS [selpatt[WinPos1[0]+TrkPos]] [0] [j] &0x7f) < NOTE_MAX) 
-       PATTERNS [selpatt[WinPos1[0]+TrkPos]] [0] [j]++;
+       if ( (PATTERNS [selpatt[WinPos1[0]+TrkPos]] [j] [PtnNoteColumn[k]] &0x7f) && (PATTERNS [selpatt[WinPos1[0]+TrkPos]] [j] [PtnNoteColumn[k]] &0x7f) < NOTE_MAX) 
+       PATTERNS [selpatt[WinPos1[0]+TrkPos]] [j] [PtnNoteColumn[k]]++;
       }
      }
-     DisPattData();
+     DirtyPattern(selpatt[WinPos1[0]+TrkPos]); DisPattData();
     }
    }
   }
@@ -1212,7 +3216,7 @@ void KeyHandler()
        PtClipSourcePtn=selpatt[WinPos1[0]+TrkPos]; PtClipSourcePos=WinPos2[0]+pattpos;
        for (i=0;i<PtnColumns;i++)
         for (j=0;j<PATTLENG[PtClipSourcePtn]-(PtClipSourcePos);j++) 
-         PtClipBoard[i][j]=PATTERNS [PtClipSourcePtn] [i] [PtClipSourcePos+j];
+         PtClipBoard[i][j]=PATTERNS [PtClipSourcePtn] [PtClipSourcePos+j] [i];
         PtClipSize=PATTLENG[PtClipSourcePtn]-(PtClipSourcePos); //j;
         DisPattData();
       }
@@ -1250,11 +3254,11 @@ void KeyHandler()
     { //copy pattern from cursor-position to clipboard
      for (i=0;i<PtnColumns;i++)
       for (j=0;j<PATTLENG[selpatt[WinPos1[0]+TrkPos]]-(WinPos2[0]+pattpos);j++) 
-      { PtClipBoard[i][j]=PATTERNS [selpatt[WinPos1[0]+TrkPos]] [i] [WinPos2[0]+pattpos+j];
-        PATTERNS [selpatt[WinPos1[0]+TrkPos]] [i] [WinPos2[0]+pattpos+j]=0;
+      { PtClipBoard[i][j]=PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos+j] [i];
+        PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos+j] [i]=0;
       }
      PtClipSourcePtn=0xFF; PtClipSize=PATTLENG[selpatt[WinPos1[0]+TrkPos]]-(WinPos2[0]+pattpos); //j;
-     DisPattData();
+     DirtyPattern(selpatt[WinPos1[0]+TrkPos]); DisPattData();
     }
     else EnterNote();
    }
@@ -1266,7 +3270,7 @@ void KeyHandler()
     for (i=0;i<MaxSeqLength-(seqpos+WinPos1[1]);i++) 
     { SeqClipBoard[i]=SEQUENCE[WinPos2[1]+TrkPos][i+seqpos+WinPos1[1]]; SEQUENCE[WinPos2[1]+TrkPos][i+seqpos+WinPos1[1]]=ORDERLIST_FX_END; }
     SeqClipSize=MaxSeqLength-(seqpos+WinPos1[1]); //i;
-    DispOrderL();
+    DirtySequence(WinPos2[1]+TrkPos,seqpos+WinPos1[1]); DispOrderL();
    }
   }
  }
@@ -1283,14 +3287,14 @@ void KeyHandler()
      {
       for (i=0;i<PtnColumns;i++)
        for (j=0;j<PtClipSize && WinPos2[0]+pattpos+j<PATTLENG[selpatt[WinPos1[0]+TrkPos]]; j++) 
-        PATTERNS [selpatt[WinPos1[0]+TrkPos]] [i] [WinPos2[0]+pattpos+j] = PtClipBoard[i][j];
-      DisPattData();
+        PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos+j] [i] = PtClipBoard[i][j];
+      DirtyPattern(selpatt[WinPos1[0]+TrkPos]); DisPattData();
      }
     }
     if (Window==1)  
     { //paste sequence at cursor-position from clipboard
      for (i=0;i<SeqClipSize && i<MaxSeqLength-(seqpos+WinPos1[1]);i++) SEQUENCE[WinPos2[1]+TrkPos][seqpos+WinPos1[1]+i] = SeqClipBoard[i];
-     DispOrderL();
+     DirtySequence(WinPos2[1]+TrkPos,seqpos+WinPos1[1]); DispOrderL();
     }
    }
   }
@@ -1299,7 +3303,7 @@ void KeyHandler()
  {
   if (!SHIFTstate && Window==0 && WinPos3[0]==0 && repeatex()==0) 
   {
-   if (FollowPlay==0 && KeyMode==1) {PATTERNS [selpatt[WinPos1[0]+TrkPos]] [0] [WinPos2[0]+pattpos]=0; CursorAdvance(); DisPattData();} //empty note
+   if (FollowPlay==0 && KeyMode==1) {PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PtnNoteColumn[NoteColumn]]=0; DirtyPattern(selpatt[WinPos1[0]+TrkPos]); CursorAdvance(); DisPattData();} //empty note
   }
   else if (!SHIFTstate) EnterHex();
   else if (SHIFTstate && repeatex()==0) if (Advance<0x10) { Advance++; DisplaySettings(); }
@@ -1337,7 +3341,7 @@ void KeyHandler()
   {
    if (!CTRLstate && !ALTstate)
    { 
-    if (Window==2) { if (INSTRUMENT[SelInst][WinPos1[2]]<0x80) { INSTRUMENT[SelInst][WinPos1[2]]++; SelectIns(SelInst); DispInstr();} }
+    if (Window==2) { if (INSTRUMENT[SelInst][InstPage*InsDimX+WinPos1[2]]<0x80) { INSTRUMENT[SelInst][InstPage*InsDimX+WinPos1[2]]++; CompileRoutes(); DirtyInstrument(SelInst); SelectIns(SelInst); DispInstr();} }
     else { if (SelInst<MaxInstAmount-1) {SelInst++;SelectIns(SelInst); DispInstr();} }
    }
    if (CTRLstate) if (Octave<9) Octave++;
@@ -1355,7 +3359,7 @@ void KeyHandler()
   {
    if (!CTRLstate && !ALTstate) 
    {
-    if (Window==2) { if (INSTRUMENT[SelInst][WinPos1[2]]>0) { INSTRUMENT[SelInst][WinPos1[2]]--; SelectIns(SelInst); DispInstr();} }
+    if (Window==2) { if (INSTRUMENT[SelInst][InstPage*InsDimX+WinPos1[2]]>0) { INSTRUMENT[SelInst][InstPage*InsDimX+WinPos1[2]]--; CompileRoutes(); DirtyInstrument(SelInst); SelectIns(SelInst); DispInstr();} }
     else { if (SelInst>0) {SelInst--;SelectIns(SelInst); DispInstr();} }
    }
    if (CTRLstate) if (Octave>0) Octave--;
@@ -1371,8 +3375,9 @@ void KeyHandler()
  {
   if(repeatex()==0) 
   {
+   if (ALTstate) { UseTimeline=(UseTimeline)?false:true; DisplaySettings(); return; } //toggle compiled-timeline playback
    if (CTRLstate || AutoFollow) FollowPlay=true; else FollowPlay=false;
-   InitRoutine(true); PlayMode=1; StartTime=SDL_GetTicks();
+   InitRoutine(true); if (UseTimeline) TimelineStart(); PlayMode=1; StartTime=SDL_GetTicks(); ClockTransport(MIDI_START);
    DispOrderL();
   }
  }
@@ -1380,8 +3385,9 @@ void KeyHandler()
  {
   if(repeatex()==0) 
   {
+   if (ALTstate) { StreamPreset[FILTER_LIVE]=(StreamPreset[FILTER_LIVE]+1)%4; DisplaySettings(); return; } //controller-stream quality of the ports
    if (CTRLstate || AutoFollow) FollowPlay=true; else FollowPlay=false;
-   InitRoutine(false); PlayMode=1; StartTime=SDL_GetTicks();
+   InitRoutine(false); PlayMode=1; StartTime=SDL_GetTicks(); ClockTransport(MIDI_CONTINUE);
   }
   DispOrderL();
  }
@@ -1389,8 +3395,9 @@ void KeyHandler()
  {
   if(repeatex()==0) 
   {
-   for(i=0;i<TrackAmount;i++) { PATTCNT[i]=SPDCNT[i]=0; DELAYCNT[i]=-1; }
-   KUSS(); PlayMode=2; StartTime=SDL_GetTicks();
+   if (ALTstate) { StreamPreset[FILTER_EXPORT]=(StreamPreset[FILTER_EXPORT]+1)%4; DisplaySettings(); return; } //controller-stream quality of the export
+   for(i=0;i<TrackAmount;i++) { PATTCNT[i]=SPDCNT[i]=TRACKWAIT[i]=0; DELAYCNT[i]=-1; }
+   KUSS(); TimelineStop(); PlayedFromStart=false; PLAYFRAME=0; PlayMode=2; StartTime=SDL_GetTicks(); CLOCKPOS=0; ClockTransport(MIDI_START);
    if (CTRLstate || AutoFollow) {FollowPlay=true; pattpos=0; DisPattData();}  else FollowPlay=false;
   }
  }
@@ -1400,7 +3407,7 @@ void KeyHandler()
   {
    if (PlayMode==0) 
    {
-    PlayMode=PrevPlayMode; 
+    PlayMode=PrevPlayMode; ClockTransport(MIDI_CONTINUE);
     if (CTRLstate || AutoFollow) { FollowPlay=true; for(i=0;i<TrackAmount;i++) selpatt[i]=SEQUENCE[i][SEQCNT[i]]; DisPattData(); } 
     else FollowPlay=false;
     DispTrkInfo(); 
@@ -1408,8 +3415,7 @@ void KeyHandler()
    else 
    {
     PrevPlayMode=PlayMode; PlayMode=0; FollowPlay=false; StopTime=SDL_GetTicks();
-    for (i=0;i<TrackAmount;i++) { if (prevnote[i]>0) NoteOff(PLAYEDINS[i],prevnote[i],0);} //AllNotesOff (PLAYEDINS[i]);}
-    KUSS();
+    KUSS(); ClockTransport(MIDI_STOP);
     DispTrkInfo();
    }
   }
@@ -1422,7 +3428,7 @@ void KeyHandler()
    if(repeatex()==0) 
    {
     if (DefaultIns[WinPos1[0]+TrkPos]>0) DefaultIns[WinPos1[0]+TrkPos]--;
-    DispTrkInfo();
+    DirtyTune(); DispTrkInfo();
    }
   }
  }
@@ -1434,13 +3440,13 @@ void KeyHandler()
    if(repeatex()==0) 
    {
     if (DefaultIns[WinPos1[0]+TrkPos]+1<0x80) DefaultIns[WinPos1[0]+TrkPos]++;
-    DispTrkInfo();
+    DirtyTune(); DispTrkInfo();
    }
   }
  }
  else if (keystate[SDLK_BACKQUOTE] || keystate[0x13a] || keystate[SDLK_KP_ENTER]) //for dvorak/us/hu layouts
  {
-  if (!SHIFTstate && !CTRLstate) fastfwd=true;
+  if (!SHIFTstate && !CTRLstate) fastfwd=(ALTstate)?-1:1; //Alt: rewind
   else if (SHIFTstate)
   { 
    if (repeatex()==0) 
@@ -1465,7 +3471,7 @@ void KeyHandler()
     if  ( mutesolo[WinPos1[0]+TrkPos] ) 
     { 
      mutesolo[WinPos1[0]+TrkPos] = false; 
-     if (prevnote[WinPos1[0]+TrkPos]>0) NoteOff(PLAYEDINS[WinPos1[0]+TrkPos],prevnote[WinPos1[0]+TrkPos],0);
+     TrackNotesOff(WinPos1[0]+TrkPos);
     }
     else mutesolo[WinPos1[0]+TrkPos]=true;
     DisPattData();
@@ -1473,6 +3479,20 @@ void KeyHandler()
   }
   else EnterNote();
  }
+ else if (keystate[SDLK_l])
+ { //queue the selected pattern (orderlist-position) for the track / launches at pattern-ends / drop the track's launches
+  if (SHIFTstate || CTRLstate || ALTstate)
+  {
+   if (repeatex()==0)
+   {
+    if (CTRLstate) { LaunchAtEnd=(LaunchAtEnd)?false:true; DisplaySettings(); }
+    else if (ALTstate) { LAUNCHQUEUE[WinPos1[0]+TrkPos].clear(); LAUNCHED[WinPos1[0]+TrkPos]=0xFF; }
+    else if (Window==1) LaunchQueue(WinPos2[1]+TrkPos,LAUNCH_SEQPOS,seqpos+WinPos1[1]);
+    else LaunchQueue(WinPos1[0]+TrkPos,LAUNCH_PATTERN,selpatt[WinPos1[0]+TrkPos]);
+   }
+  }
+  else EnterNote();
+ }
  else if (keystate[SDLK_s])
  {
   if (SHIFTstate)
@@ -1496,7 +3516,7 @@ void KeyHandler()
       if (SEQUENCE[i][j]<ORDERLIST_FX_MIN && SEQUENCE[i][j]>yetmax) yetmax=SEQUENCE[i][j];
      }
     }
-    if (yetmax<ORDERLIST_FX_MIN) {SEQUENCE[WinPos2[1]][WinPos1[1]+seqpos]=yetmax+1; DispOrderL();}
+    if (yetmax<ORDERLIST_FX_MIN) {SEQUENCE[WinPos2[1]][WinPos1[1]+seqpos]=yetmax+1; DirtySequence(WinPos2[1],WinPos1[1]+seqpos); DispOrderL();}
    }
   }
  }
@@ -1510,7 +3530,7 @@ void KeyHandler()
  }
  else
  { //no (useful) key pressed
-  repecnt=repspd1; fastfwd=false;
+  RepeatTime=0; fastfwd=0;
   if (PrevJamNote) {NoteOff(SelInst,PrevJamNote,0x7f); PrevJamNote=0; if(PlayMode==0)AllNotesOff(SelInst); } //prevnote[WinPos1[0]+TrkPos]=0;}
  }
 }
@@ -1522,6 +3542,10 @@ void KeyInstNote()
  {
   if (PrevJamNote&0x7F!=0) NoteOff(SelInst,PrevJamNote,0x7F); //if notes played legato (without break inbetween)
   NoteOn(SelInst,NoteKeyVal(),0x7f); UniqueCC(SelInst,01,0x00); //new note resets Modulation wheel (Vibrato Amplitude)
+  if (KeyFresh && !DispNote && ROUTE[SelInst].Layers && ROUTE[ROUTE[SelInst].Layer[0]].Port<PortAmount)
+  { //the key-event's note is sent (or held back by the port's latency-compensation)
+   KeyLatencyHist[Log2Bucket(SDL_GetTicks()-KeyArrival+PortDelay[ROUTE[ROUTE[SelInst].Layer[0]].Port])]++; KeyFresh=false;
+  }
  }
  PrevJamNote=NoteKeyVal()&0x7F;
 }
@@ -1535,9 +3559,10 @@ void EnterNote()
      { 
       if(repeatex()==0 && NoteKeyVal()!=0xFF && (NoteKeyVal()&0x7f)<=NOTE_MAX) 
       {
-       PATTERNS [selpatt[WinPos1[0]+TrkPos]] [0] [WinPos2[0]+pattpos]=NoteKeyVal()&0x7F;
-       //PATTERNS [selpatt[WinPos1[0]+TrkPos]] [1] [WinPos2[0]+pattpos] &= 0x0F;
-       //PATTERNS [selpatt[WinPos1[0]+TrkPos]] [1] [WinPos2[0]+pattpos] |= 0xF0;
+       PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PtnNoteColumn[NoteColumn]]=NoteKeyVal()&0x7F;
+       //PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PTN_FX] &= 0x0F;
+       //PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PTN_FX] |= 0xF0;
+       DirtyPattern(selpatt[WinPos1[0]+TrkPos]);
        KeyInstNote();
        CursorAdvance();DisPattData();
       }
@@ -1559,7 +3584,7 @@ void EnterHex()
    if  ( mutesolo[HexKeyVal()-1] ) 
    { 
     mutesolo[HexKeyVal()-1] = false; 
-    if (prevnote[HexKeyVal()-1]>0) NoteOff(PLAYEDINS[HexKeyVal()-1],prevnote[HexKeyVal()-1],0);
+    TrackNotesOff(HexKeyVal()-1);
    }
    else mutesolo[HexKeyVal()-1]=true;
    DisPattData();
@@ -1571,6 +3596,11 @@ void EnterHex()
   if (HexKeyVal()<10 && repeatex()==0) { Octave=HexKeyVal(); DisplaySettings(); }  
   return; 
  }
+ if (ALTstate) 
+ { //fast-forward/rewind speed
+  if (HexKeyVal()<10 && repeatex()==0) ffwdspeed=ScrubSpeeds[HexKeyVal()];
+  return; 
+ }
  if (Window==0)
  {
   if (WinPos3[0]>0)
@@ -1581,24 +3611,24 @@ void EnterHex()
     {
      if ((WinPos3[0]-1)&1) 
      {
-      PATTERNS [selpatt[WinPos1[0]+TrkPos]] [(WinPos3[0]-1)/2+1] [WinPos2[0]+pattpos] &= 0xF0;
-      PATTERNS [selpatt[WinPos1[0]+TrkPos]] [(WinPos3[0]-1)/2+1] [WinPos2[0]+pattpos] |= HexKeyVal();
+      PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PTN_FX+(WinPos3[0]-1)/2] &= 0xF0;
+      PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PTN_FX+(WinPos3[0]-1)/2] |= HexKeyVal();
       if (WinPos3[0]==2) CurRight();
      }
      else 
      {
-      PATTERNS [selpatt[WinPos1[0]+TrkPos]] [(WinPos3[0]-1)/2+1] [WinPos2[0]+pattpos] &= 0x0F;
-      PATTERNS [selpatt[WinPos1[0]+TrkPos]] [(WinPos3[0]-1)/2+1] [WinPos2[0]+pattpos] |= HexKeyVal()*16;
+      PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PTN_FX+(WinPos3[0]-1)/2] &= 0x0F;
+      PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PTN_FX+(WinPos3[0]-1)/2] |= HexKeyVal()*16;
       if (WinPos3[0]==3) CurRight(); 
       else if (WinPos3[0]=1) CursorAdvance();
      }
-     DisPattData();
+     DirtyPattern(selpatt[WinPos1[0]+TrkPos]); DisPattData();
     }
    }
   }
   else
   { //note entry/jam
-   if (HexKeyVal()==1 && FollowPlay==0 && KeyMode==1 ) { if (repeatex()==0) {PATTERNS [selpatt[WinPos1[0]+TrkPos]] [0] [WinPos2[0]+pattpos]=0; CursorAdvance(); DisPattData();} } //empty note
+   if (HexKeyVal()==1 && FollowPlay==0 && KeyMode==1 ) { if (repeatex()==0) {PATTERNS [selpatt[WinPos1[0]+TrkPos]] [WinPos2[0]+pattpos] [PtnNoteColumn[NoteColumn]]=0; DirtyPattern(selpatt[WinPos1[0]+TrkPos]); CursorAdvance(); DisPattData();} } //empty note
    else EnterNote();
   }
  }
@@ -1606,6 +3636,7 @@ void EnterHex()
  {
   if (repeatex()==0) 
   {
+   DirtySequence(WinPos2[1]+TrkPos,seqpos+WinPos1[1]);
    if (SEQUENCE[WinPos2[1]+TrkPos][seqpos+WinPos1[1]]==0xFF) SEQUENCE[WinPos2[1]+TrkPos][seqpos+WinPos1[1]]=0x00;
    if (WinPos3[1]==0) {SEQUENCE[WinPos2[1]+TrkPos][seqpos+WinPos1[1]] &=0x0F; SEQUENCE[WinPos2[1]+TrkPos][seqpos+WinPos1[1]] |= HexKeyVal()*16; CurRight();} 
    else  {SEQUENCE[WinPos2[1]+TrkPos][seqpos+WinPos1[1]] &=0xF0; SEQUENCE[WinPos2[1]+TrkPos][seqpos+WinPos1[1]] |= HexKeyVal(); } 
@@ -1616,9 +3647,9 @@ void EnterHex()
  {
   if (repeatex()==0) 
   {
-   if (WinPos3[2]==0) {INSTRUMENT[SelInst][WinPos1[2]] &=0x0F; INSTRUMENT[SelInst][WinPos1[2]] |= HexKeyVal()*16; CurRight();} 
-   else  {INSTRUMENT[SelInst][WinPos1[2]]  &=0xF0; INSTRUMENT[SelInst][WinPos1[2]]  |= HexKeyVal(); if(WinPos1[2]==WinPos1Max[2]) WinPos3[2]--;} 
-   SelectIns(SelInst); DispInstr(); 
+   if (WinPos3[2]==0) {INSTRUMENT[SelInst][InstPage*InsDimX+WinPos1[2]] &=0x0F; INSTRUMENT[SelInst][InstPage*InsDimX+WinPos1[2]] |= HexKeyVal()*16; CurRight();} 
+   else  {INSTRUMENT[SelInst][InstPage*InsDimX+WinPos1[2]]  &=0xF0; INSTRUMENT[SelInst][InstPage*InsDimX+WinPos1[2]]  |= HexKeyVal(); if(WinPos1[2]==WinPos1Max[2]) WinPos3[2]--;} 
+   CompileRoutes(); DirtyInstrument(SelInst); SelectIns(SelInst); DispInstr(); 
   } 
  }
 }
@@ -1682,6 +3713,7 @@ unsigned char NoteKeyVal()
 
 void DispTrkInfo()
 {
+ if (Overlay || DrawLater(REDRAW_TRACKINFO)) return;
  int i;
  for (i=0;i<PattDimX;i++)
  {
@@ -1720,20 +3752,22 @@ const char NoteString[256][5]={ "...:",
 
 void DisPattData()
 {
- int i,j; unsigned char notedata,fx,fxval; float ratio;
+ if (Overlay || DrawLater(REDRAW_PATTERN)) return;
+ int i,j; unsigned char notedata,fx,fxval,*row; float ratio;
  for (j=0;j<PattDimX;j++)
  {
   PutString (PattPosX+2+j*9,PattPosY,(mutesolo[j+TrkPos])?"Tr":"--"); put2digit(PattPosX+4+j*9,PattPosY,j+1+TrkPos);
   PutString (PattPosX+6+j*9,PattPosY,"-P"); put2hex(PattPosX+8+j*9,PattPosY,selpatt[j+TrkPos]);
  }
  PutString (PattPosX+1,PattPosY+1,"@@@@@@@@@ @@@@@@@@ @@@@@@@@ @@@@@@@@ @@@@@@@@ @@@@@@@@ @@@@@@@@ @@@@@@@@@");
+ PutChar (PattPosX-1,PattPosY+1,'N',0,0); put1hex(PattPosX,PattPosY+1,NoteColumn+1); //the shown note-column
  for (j=0;j<PattDimX;j++)
  {
   for(i=0;i<PattDimY;i++)
   {
    if (i+pattpos<PATTLENG[selpatt[j+TrkPos]])
    {
-    notedata=PATTERNS[selpatt[j+TrkPos]][0][i+pattpos]; fx=PATTERNS[selpatt[j+TrkPos]][1][i+pattpos]; fxval=PATTERNS[selpatt[j+TrkPos]][2][i+pattpos];
+    row=PATTERNS[selpatt[j+TrkPos]][i+pattpos]; notedata=row[PtnNoteColumn[NoteColumn]]; fx=row[PTN_FX]; fxval=row[PTN_FXVALUE];
     PutString (PattPosX+2+j*9,PattPosY+2+i,NoteString[notedata]); 
     if (PtClipSourcePtn==selpatt[j+TrkPos] && PtClipSourcePos<=i+pattpos && i+pattpos<PtClipSize+PtClipSourcePos)
     { //show selection
@@ -1768,17 +3802,19 @@ void DisPattData()
 
 void DisPattCnt(int j)
 {
+ if (Overlay || DrawLater(REDRAW_COUNTERS)) return;
  int i;
  if (j<TrkPos || j>=TrkPos+PattDimX) return; //displayability check
  for(i=0;i<PattDimY;i++)
  {
-  PutChar (PattPosX+10+(j-TrkPos)*9,PattPosY+2+i,(PATTCNT[j]==i+pattpos && (selpatt[j]==SEQUENCE[j][SEQCNT[j]] || PlayMode==2))?'<':' ',0,0);
+  PutChar (PattPosX+10+(j-TrkPos)*9,PattPosY+2+i,(PATTCNT[j]==i+pattpos && (selpatt[j]==((LAUNCHED[j]!=0xFF)?LAUNCHED[j]:SEQUENCE[j][SEQCNT[j]]) || PlayMode==2))?'<':' ',0,0);
  }
  SDL_UpdateRect(screen, (PattPosX+(j-TrkPos)*9+10)*CharSizeX, (PattPosY+0)*CharSizeY-1, CharSizeX, (PattDimY+2)*CharSizeY+1);
 }
 
 void DispSeqCnt(int i)
 {
+ if (Overlay || DrawLater(REDRAW_COUNTERS)) return;
  int j;
  if (i<TrkPos || i>=TrkPos+OrDimY) return; //displayability check
  for (j=0;j<OrDimX;j++)
@@ -1793,6 +3829,7 @@ void DispSeqCnt(int i)
 
 void DispOrderL()
 {
+ if (Overlay) return;
  int i,j; unsigned char olidata;
  for (i=0;i<=OrDimY+1;i++)
  {
@@ -1840,9 +3877,12 @@ const char GMinstName[128+1][15]={ "Press F12:Help",
  "FretNoise FX","BreathNoise FX","SeaShore FX","BirdTweet FX","Telephone FX","Helicopter FX","Applause FX","GunShot FX"
 };
 
+const char *InstPageTitle[InstPages]={"Ins-Po-CV-Pat","Ins-KL-KH-Trn","Ins-VL-VH-Lay"};
 void DispInstr()
 {
+ if (Overlay) return;
  int i;
+ PutString(InstPosX-2,InstPosY,InstPageTitle[InstPage]);
  PutString(InstPosX+1,InstPosY+4,"-  -  -   ");
  for (i=0;i<InsDimY;i++)
  {
@@ -1850,9 +3890,9 @@ void DispInstr()
   else
   {
    put2hex(InstPosX-2,InstPosY+1+i,SelInst+i-3);
-   put2hex(InstPosX+2,InstPosY+1+i,INSTRUMENT[SelInst+i-3][INST_PORT]);
-   put2hex(InstPosX+5,InstPosY+1+i,INSTRUMENT[SelInst+i-3][INST_CHVOL]);
-   put2hex(InstPosX+8,InstPosY+1+i,INSTRUMENT[SelInst+i-3][INST_PATCH]);
+   put2hex(InstPosX+2,InstPosY+1+i,INSTRUMENT[SelInst+i-3][InstPage*InsDimX]);
+   put2hex(InstPosX+5,InstPosY+1+i,INSTRUMENT[SelInst+i-3][InstPage*InsDimX+1]);
+   put2hex(InstPosX+8,InstPosY+1+i,INSTRUMENT[SelInst+i-3][InstPage*InsDimX+2]);
    PutChar(InstPosX+10,InstPosY+1+i,' ',0,0);
   }
  }
@@ -1861,12 +3901,13 @@ void DispInstr()
  // { PutChar(InstPosX+i-3,InstPosY+InsDimY+3,ascii2petscii(INSTRUMENT[SelInst][INST_NAME+i]),0,0); }
  //PutString(InstPosX-3,InstPosY+InsDimY+2,"              ");
  PutString(InstPosX-3,InstPosY+InsDimY+2,GMinstName[INSTRUMENT[SelInst][INST_PATCH]],14);
- SDL_UpdateRect(screen, (InstPosX-3)*CharSizeX, (InstPosY+1)*CharSizeY, WinSizeX-(InstPosX-2)*CharSizeX+1, (InsDimY+3)*CharSizeY+1);
+ SDL_UpdateRect(screen, (InstPosX-3)*CharSizeX, InstPosY*CharSizeY, WinSizeX-(InstPosX-2)*CharSizeX+1, (InsDimY+4)*CharSizeY+1);
 }
 
 char PtnPoss[]={0,4,5,6,7};
 void DispCursor()
 {
+ if (Overlay) return;
  if (Window==0) {CurPosX=PattPosX+2+WinPos1[0]*9+PtnPoss[WinPos3[0]]; CurPosY=PattPosY+2+WinPos2[0]; CurWide=(WinPos3[0]<1) ? 3 : 1; }
  else if (Window==1) {CurPosX=OrdListPosX+2+WinPos1[1]*3+WinPos3[1]; CurPosY=OrdListPosY+2+WinPos2[1]; CurWide=1;}
  else if (Window==2) {CurPosX=InstPosX+2+WinPos1[2]*3+WinPos3[2];CurPosY=InstPosY+4;CurWide=1;}
@@ -1883,7 +3924,8 @@ void DispCursor()
  CursoRect.x=CurPosX*8; CursoRect.y=CurPosY*8; CursoRect.w=CharSizeX; CursoRect.h=CharSizeY;
  SDL_UpdateRect(screen, CursoRect.x-1, CursoRect.y-1, CursoRect.w*CurWide+2, CursoRect.h*CurWide+2); 
  if (CurColor>=256-32) ColDir=-1; else if (CurColor<=0) ColDir=1;
- CurColor+=8*((KeyMode+1)*2)*ColDir;
+ CurColor+=8*((KeyMode+1)*2)*ColDir*(CURSOR_BLINK/TimerInterval); //same blink-period at the rate of the cursor-timer
+ if (CurColor>256-32) CurColor=256-32; else if (CurColor<0) CurColor=0;
 }
 
 void RefreshCursor ()
@@ -1915,26 +3957,42 @@ void DisplayStatic()
 
 void DisplaySettings()
 {
+ if (Overlay) return;
  //put2digit(InstPosX+5,InstPosY+7,TiMinute); put2digit(InstPosX+8,InstPosY+7,TiSecond);
  //put2hex(InstPosX+0,InstPosY+7,SelInst); 
  put1hex(12+6,StatPosY,Octave); 
  put2digit(20+3,StatPosY,Advance);
  PutString(26+8,StatPosY,(KeyMode)? "Edit" : "Jam ");
  PutString (39,StatPosY,(AutoFollow)?"AutFlw":"ManFlw");
+ PutChar (0,StatPosY,(UseTimeline)?'T':' ',0,0); //F1 plays the compiled timeline
+ PutChar (45,StatPosY,(LaunchAtEnd)?'P':' ',0,0); //launches wait for pattern-ends
+ PutString (46,StatPosY,(SlaveMode==SLAVE_CLOCK)?"Clock:":(SlaveMode==SLAVE_MTC)?"  MTC:":"Input:"); //clock/timecode-jitter or input-note follows
  put2digit(46+14,StatPosY,UsedInPort+0); 
  PutString (46+17,StatPosY,"                "); 
    if (UsedInPort<midiin->getPortCount()) PutString (46+17,StatPosY,midiin->getPortName(UsedInPort),16);
  SDL_UpdateRect(screen, 0, StatPosY*CharSizeY, WinSizeX, CharSizeY);
+ put1hex(InstPosX+10,InstPosY+InsDimY+1,StreamPreset[FILTER_LIVE]); put1hex(InstPosX+11,InstPosY+InsDimY+1,StreamPreset[FILTER_EXPORT]); //controller-stream qualities
+ SDL_UpdateRect(screen, (InstPosX+10)*CharSizeX, (InstPosY+InsDimY+1)*CharSizeY, 2*CharSizeX, CharSizeY);
 }
 
 void DispMIDIevent()
-{
- PutString(46+6,StatPosY,NoteString[DispNote],3);
+{ //the note on the MIDI-input, or the clock-jitter of the master (ms) if following its clock or timecode
+ if (Overlay) return;
+ char jitter[8];
+ double period, mean;
+ if (SlaveMode)
+ {
+  SDL_LockMutex(InputLock); period=ExtPeriod; mean=ExtJitter; SDL_UnlockMutex(InputLock);
+  if (period<=0) strcpy(jitter,"---"); else if (mean<9.95) sprintf(jitter,"%.1f",mean); else sprintf(jitter,"%3u",(mean<999)? (unsigned int)mean : 999);
+  PutString(46+6,StatPosY,jitter,3);
+ }
+ else PutString(46+6,StatPosY,NoteString[DispNote],3);
  SDL_UpdateRect(screen, (46+6)*CharSizeX, StatPosY*CharSizeY, CharSizeX*3, CharSizeY);
 }
 
 void Display()
 {
+ if (Overlay || DrawLater(REDRAW_ALL)) return; //a dialog covers the screen
  DispCursor();
  DisPattData();
  DispOrderL();
@@ -1948,11 +4006,11 @@ void DisplayHelp()
  int HelpX=(WinSizeX/CharSizeX)/2-HelpDimX/2, HelpY=(WinSizeY/CharSizeY)/2-HelpDimY/2, i,j;
  
  //PlayMode=0; FollowPlay=false; StopTime=SDL_GetTicks();
- for (i=0;i<TrackAmount;i++) { if (prevnote[i]>0) NoteOff(PLAYEDINS[i],prevnote[i],0); AllNotesOff (PLAYEDINS[i]);}
+ OverlayOpen();
  
  for(i=HelpDimY/2;i>=0;i--)
  {
-  SDL_Delay(5);
+  OverlayWait(5);
   for(j=0;j<HelpDimX;j++)
   {
    if (helptxt[i][j]) PutChar(HelpX+j,HelpY+i,ascii2petscii(helptxt[i][j]),0,0);
@@ -1971,17 +4029,18 @@ void DisplayHelp()
  
  while (stillreading)
  {
-  SDL_PollEvent(&event);
+  OverlayEvent(&event);
   if ( event.type == SDL_KEYDOWN && (event.key.keysym.sym==SDLK_RETURN || event.key.keysym.sym==SDLK_ESCAPE)) stillreading=false;
-  SDL_Delay(5);
  }
 
  WaitKeyRelease();
+ OverlayClose();
 }
 
 void DisplayGMset()
 {
  int HelpX=(WinSizeX/CharSizeX)/2-(HelpDimX+12)/2, HelpY=(WinSizeY/CharSizeY)/2-HelpDimY/2, i,j,OutPorts=0;
+ OverlayOpen();
  for(i=0;i<HelpDimY;i++)
  {
   PutString(HelpX,HelpY+i,"                                                                           ");
@@ -2003,14 +4062,15 @@ void DisplayGMset()
   }
  }
  SDL_UpdateRect(screen, 0, 0, 0, 0);
- SDL_PollEvent(&event);
+ event.type=SDL_NOEVENT;
  //keystate = SDL_GetKeyState(NULL);
  while (event.type != SDL_KEYUP) //(keystate[SDLK_RETURN] || keystate[SDLK_ESCAPE]) ; //wait to release keys
  {
-   SDL_PollEvent(&event);
+  OverlayEvent(&event);
   //keystate = SDL_GetKeyState(NULL); SDL_Delay(5);
  }
- SDL_PollEvent(&event); SDL_Delay(100);
+ OverlayWait(100);
+ OverlayClose();
 }
 
 void InitGUI()
@@ -2105,8 +4165,55 @@ void PutChar(int x, int y, unsigned char chcode, int BGcol, int FGcol)
 //---------------------------------TUNE-FILE OPERATIONS--------------------------------------------
 const unsigned char InsNameStr[]="..............";
 
-void InitMusicData(bool putTemplate)
-{
+struct TuneData
+{ //music-data of a tune (as in the tune-file)
+ unsigned char Setting[TuneSettingSize], DefaultIns[TrackAmount], Sequence[TrackAmount][MaxSeqLength], PattLeng[MaxPtnAmount];
+ unsigned char Patterns[MaxPtnAmount][MaxPtnLength][PtnColumns], Instrument[MaxInstAmount][InstrumSize];
+};
+TuneData SpareTune; //the current tune waits here while the song-library previews another one
+
+unsigned int MeasureTune(const TuneData &tune)
+{ //frames of a tune till every track ended or reached its first loop (as exported): only the row-timing of the player
+  //is followed, on the tune's own data and counters, so any thread can measure
+ static const unsigned char EmptyRow[PtnColumns]={0};
+ int seqcnt[TrackAmount], pattcnt[TrackAmount], spdcnt[TrackAmount], tempo[TrackAmount], delaycnt[TrackAmount];
+ unsigned char bpm[TrackAmount], rowsperbeat[TrackAmount], tunebpm=0; unsigned int rowlength[TrackAmount], rowclock[TrackAmount];
+ TuneTiming walk={seqcnt,pattcnt,spdcnt,tempo,delaycnt,bpm,rowsperbeat,&tunebpm,rowlength,rowclock};
+ unsigned int frames=0, playing=(1<<TrackAmount)-1;
+ int i, chptn, length, value;
+ const unsigned char *row;
+ for (i=0;i<TrackAmount;i++) { seqcnt[i]=pattcnt[i]=0; tempo[i]=spdcnt[i]=deftempo; delaycnt[i]=-1; bpm[i]=0; rowsperbeat[i]=defrowsperbeat; rowlength[i]=rowclock[i]=0; }
+ while (playing && frames<TIMELINE_MAXFRAMES)
+ {
+  for (i=TrackAmount-1;i>=0;i--) if (playing&(1<<i))
+  {
+   if (RowDelayed(walk,i) || !RowDue(walk,i)) continue;
+   chptn=tune.Sequence[i][seqcnt[i]];
+   row=(chptn<MaxPtnAmount)? tune.Patterns[chptn][pattcnt[i]] : EmptyRow;
+   if (!RowStart(walk,i,row)) continue;
+   if ((value=RowTempo(row))>=0) TimingTempo(walk,i,value);
+   length=(chptn<MaxPtnAmount)? tune.PattLeng[chptn] : 0; //no pattern: one empty row
+   if (RowNext(walk,i,length))
+   {
+    seqcnt[i]++;
+    if (seqcnt[i]>=MaxSeqLength || tune.Sequence[i][seqcnt[i]]>=ORDERLIST_FX_MIN) playing&=~(1<<i); //jump or end
+   }
+  }
+  frames++;
+ }
+ return frames;
+}
+
+void ClearTune(TuneData &tune)
+{ //empty sequences, patterns and instruments of a tune outside the music-data (as ClearTuneData)
+ int i;
+ memset(tune.Sequence,0xFF,sizeof(tune.Sequence)); memset(tune.DefaultIns,0,sizeof(tune.DefaultIns));
+ memset(tune.Patterns,0,sizeof(tune.Patterns)); memset(tune.PattLeng,0x40,sizeof(tune.PattLeng));
+ for (i=0;i<MaxInstAmount;i++) { memset(tune.Instrument[i],0,InstrumSize); memcpy(tune.Instrument[i]+INST_NAME,InsNameStr,sizeof(InsNameStr)); }
+}
+
+void ClearTuneData()
+{ //empty sequences, patterns and instruments
  int i,j,k;
  for (i=0;i<TrackAmount;i++)
  {
@@ -2122,7 +4229,7 @@ void InitMusicData(bool putTemplate)
   {
    for (j=0;j<PtnColumns;j++)
    {
-    PATTERNS[i][j][k] = 0; //i+j+(k*16)&0xFF;
+    PATTERNS[i][k][j] = 0; //i+j+(k*16)&0xFF;
    }
   }
  }
@@ -2135,6 +4242,21 @@ void InitMusicData(bool putTemplate)
   for(j=0;j<INST_NAME;j++) INSTRUMENT[i][j]=0; //i;
   for(j=INST_NAME;j<InstrumSize;j++) INSTRUMENT[i][j]=InsNameStr[j-INST_NAME];
  }
+}
+
+void SwapTune(TuneData &tune)
+{ //exchange the music-data with another tune's
+ std::swap_ranges(TUNESETTING,TUNESETTING+TuneSettingSize,tune.Setting);
+ std::swap_ranges(DefaultIns,DefaultIns+TrackAmount,tune.DefaultIns);
+ std::swap_ranges(&SEQUENCE[0][0],&SEQUENCE[0][0]+sizeof(SEQUENCE),&tune.Sequence[0][0]);
+ std::swap_ranges(PATTLENG,PATTLENG+MaxPtnAmount,tune.PattLeng);
+ std::swap_ranges(&PATTERNS[0][0][0],&PATTERNS[0][0][0]+sizeof(PATTERNS),&tune.Patterns[0][0][0]);
+ std::swap_ranges(&INSTRUMENT[0][0],&INSTRUMENT[0][0]+sizeof(INSTRUMENT),&tune.Instrument[0][0]);
+}
+
+void InitMusicData(bool putTemplate)
+{
+ ClearTuneData();
  if (putTemplate)
  {
   //a little template to start with
@@ -2143,23 +4265,102 @@ void InitMusicData(bool putTemplate)
   SEQUENCE[2][0]=3;SEQUENCE[2][1]=ORDERLIST_FX_JUMP;SEQUENCE[2][2]=0;
   SEQUENCE[3][0]=4;SEQUENCE[3][1]=ORDERLIST_FX_JUMP;SEQUENCE[3][2]=0;
   SEQUENCE[4][0]=0;SEQUENCE[5][0]=0;SEQUENCE[6][0]=0;SEQUENCE[7][0]=0;
-  PATTERNS[1][1][0]=0x0C; PATTERNS[1][2][0]=0x01;
-  PATTERNS[0][1][0]=0x0F; PATTERNS[0][2][0]=0x06;
+  PATTERNS[1][0][PTN_FX]=0x0C; PATTERNS[1][0][PTN_FXVALUE]=0x01;
+  PATTERNS[0][0][PTN_FX]=0x0F; PATTERNS[0][0][PTN_FXVALUE]=0x06;
   INSTRUMENT[0][INST_PORT]=0x00; INSTRUMENT[0][INST_CHVOL]=0x90; INSTRUMENT[1][INST_PATCH]=0x00; //DRUMKIT
   INSTRUMENT[1][INST_PORT]=0x01; INSTRUMENT[1][INST_CHVOL]=0x00; INSTRUMENT[1][INST_PATCH]=0x01; //PIANO
   INSTRUMENT[2][INST_PORT]=0x02; INSTRUMENT[2][INST_CHVOL]=0x10; INSTRUMENT[2][INST_PATCH]=0x51; //SOLO
  }
+ CompileRoutes();
  PtClipSourcePtn=0xFF;
- InitRoutine(true); ResetPos(); PlayMode=0; SetSelPatt();
+ InitRoutine(true); ResetPos(); PlayMode=0; SetSelPatt(); DirtyTune();
 }
 
 //------------------------------------------------------------------------------------
 #define PATH_LENGTH_MAX 256
-#define DIR_FILES_MAX 16384
+#define DIR_SLICE 256 //directory-entries read in a round of the file-selector (the list shows up while the folder is read)
 #define FILENAME_LENGTH_MAX 58
 char path[PATH_LENGTH_MAX]="";
 char FileName[FILENAME_LENGTH_MAX+8]={""};
+char FileFilter[FILENAME_LENGTH_MAX+8]={""}; //typed name narrowing the file-list (without extension, case-insensitive)
 char extensions[][8]={".mit",".mid",".midi",".MIT",".MID",".MIDI"};
+struct FileEntry { std::string Name; unsigned char IsFile; };
+std::vector<FileEntry> DirList; //entries of the folder read so far, sorted: folders first, then by name
+std::vector<unsigned int> DirShown; //entries of DirList passing the filter, in the file-list
+DIR *DirScanning=NULL; //folder being read in the background of the file-selector
+
+bool DirEntryLess(const FileEntry &a, const FileEntry &b)
+{
+ return a.IsFile<b.IsFile || (a.IsFile==b.IsFile && cmpstr((char*)a.Name.c_str(),(char*)b.Name.c_str())<0);
+}
+
+void DirScanStop()
+{
+ if (DirScanning) closedir(DirScanning);
+ DirScanning=NULL;
+}
+
+void DirScanStart()
+{ //start reading the actual folder
+ DirScanStop(); DirList.clear(); DirShown.clear();
+#ifdef __amigaos__
+ DirScanning = opendir("");
+#else
+ DirScanning = opendir(".");
+#endif
+}
+
+unsigned char EntryIsFile(DIR *dir, struct dirent *DirEntry, const char *path)
+{ //not a folder (links followed), 'path' is for systems without the type in the entry
+ struct stat st;
+#ifdef DT_UNKNOWN
+ if (DirEntry->d_type!=DT_UNKNOWN && DirEntry->d_type!=DT_LNK) return DirEntry->d_type!=DT_DIR; //no stat() needed
+ return !(fstatat(dirfd(dir),DirEntry->d_name,&st,0)==0 && S_ISDIR(st.st_mode));
+#else
+ return !(stat(path,&st)==0 && S_ISDIR(st.st_mode));
+#endif
+}
+
+bool TuneExtension(char *name)
+{
+ char *ext=FilExt(name);
+ return !strcmp(extensions[0],ext) || !strcmp(extensions[1],ext) || !strcmp(extensions[2],ext) 
+        || !strcmp(extensions[3],ext) || !strcmp(extensions[4],ext) || !strcmp(extensions[5],ext);
+}
+
+bool DirScan()
+{ //read the next slice of entries (folders & tunes), merged into the sorted list, false if nothing new came
+ struct dirent *DirEntry; FileEntry entry; unsigned int i, sorted=DirList.size();
+ if (DirScanning==NULL) return false;
+ for (i=0;i<DIR_SLICE;i++)
+ {
+  if ((DirEntry=readdir(DirScanning))==NULL) { DirScanStop(); break; }
+  entry.IsFile=EntryIsFile(DirScanning,DirEntry,DirEntry->d_name);
+  if (!entry.IsFile || TuneExtension(DirEntry->d_name)) { entry.Name=DirEntry->d_name; DirList.push_back(entry); }
+ }
+ if (DirList.size()==sorted) return false;
+ std::sort(DirList.begin()+sorted,DirList.end(),DirEntryLess);
+ std::inplace_merge(DirList.begin(),DirList.begin()+sorted,DirList.end(),DirEntryLess);
+ return true;
+}
+
+bool NameMatches(const char *name, const char *filter)
+{ //filter is in the name (case-insensitive)
+ int i;
+ for (;*name;name++)
+ {
+  for (i=0; filter[i] && tolower((unsigned char)name[i])==tolower((unsigned char)filter[i]); i++);
+  if (!filter[i]) return true;
+ }
+ return !filter[0];
+}
+
+void DirFilter()
+{ //the file-list: the entries matching the filter, folders always stay for moving around
+ unsigned int i;
+ DirShown.clear();
+ for (i=0;i<DirList.size();i++) if (!DirList[i].IsFile || NameMatches(DirList[i].Name.c_str(),FileFilter)) DirShown.push_back(i);
+}
 
 #define NameKeyAmount 40
 unsigned char NameKeys[NameKeyAmount]={ 
@@ -2186,19 +4387,24 @@ unsigned char NameKeyVal()
  return i;
 }
 
+void TypeFilter(int *dirpos, int *fcurpos, int *amount)
+{ //the typed name narrows the file-list (from what's read already, no re-reading)
+ strcpy(FileFilter,FileName); CutExt(FileFilter);
+ DirFilter(); *amount=DirShown.size();
+ if (*dirpos+*fcurpos>=*amount) *dirpos=*fcurpos=0;
+}
+
 int FileSelector(const char* title)
 {
- static int i,j,first,amount,FilerSizeX=62, FilerPosX=(WinSizeX/CharSizeX)/2-FilerSizeX/2, FilerPosY=1, FilerSizeY=WinSizeY/CharSizeY-2;
+ static int i,amount,FilerSizeX=62, FilerPosX=(WinSizeX/CharSizeX)/2-FilerSizeX/2, FilerPosY=1, FilerSizeY=WinSizeY/CharSizeY-2;
  static const int listX=15,listY=7,typerY=FilerSizeY-4,ListSizeY=typerY-listY-2,typerX=1;
  static int dirpos=0, fcurpos=0, typepos, fmode=0, selplace=0, curcount=0, flashstate=0x80;  //fmode: 0-file, 1-place
  static unsigned char curchar=' ';
  static const int flashspd=20, placemax=18; 
- DIR *Directory;
- struct dirent *DirEntry; struct stat st;
- typedef struct { char *Name; unsigned char IsFile; } direntry;
- direntry dirlist[DIR_FILES_MAX], entrytmp;
+ std::string current; //entry under the cursor, kept there while the list changes
+ char status[24];
 
- for (i=0;i<TrackAmount;i++) { if (prevnote[i]>0) NoteOff(PLAYEDINS[i],prevnote[i],0); AllNotesOff (PLAYEDINS[i]);}
+ OverlayOpen();
 
  static const char FilerSidebar[][14] = {
  "Places:","@@@@@@@","","  /(FileSys)","  /root","  /home","  /media","  /mnt","","  /Volumes","  /Users","  /Downloads","","   A:/","   B:/","   C:/","   D:/","   E:/","   F:/","   G:/","   H:/","   I:/","   J:/","",
@@ -2215,7 +4421,7 @@ int FileSelector(const char* title)
  //RemoveTimer();
 REREADIR: 
  WaitKeyRelease();
- dirpos=fcurpos=0; //init cursors
+ dirpos=fcurpos=amount=0; FileFilter[0]=0; //init cursors
  //display file-list and selector-layout
  for (i=0;i<FilerSizeY;i++) 
  {
@@ -2235,49 +4441,24 @@ REREADIR:
  getcwd(path, 255); 
  if (strlen(path)<FilerSizeX-4) PutString(FilerPosX+1,FilerPosY+4,path,FilerSizeX-4);
  else PutString(FilerPosX+1,FilerPosY+4,path+(strlen(path)-(FilerSizeX-4)),FilerSizeX-4);
-    //for (i = 0; i < DIR_FILES_MAX; i++) if (dirlist[i].Name) { free(dirlist[i].Name); dirlist[i].Name=NULL; }   // Deallocate old names
- // Process directory
-#ifdef __amigaos__
- Directory = opendir("");
-#else
- Directory = opendir(".");
-#endif
-
- amount=0; //counts entries
- while ((DirEntry = readdir(Directory)))
- {
-  stat(DirEntry->d_name, &st); if (st.st_mode & S_IFDIR) dirlist[amount].IsFile=0; else dirlist[amount].IsFile=1;
-  if ( !dirlist[amount].IsFile || !strcmp(extensions[0],FilExt(DirEntry->d_name)) || !strcmp(extensions[1],FilExt(DirEntry->d_name)) 
-       || !strcmp(extensions[2],FilExt(DirEntry->d_name)) || !strcmp(extensions[3],FilExt(DirEntry->d_name)) 
-       || !strcmp(extensions[4],FilExt(DirEntry->d_name)) || !strcmp(extensions[5],FilExt(DirEntry->d_name)) )
-  { 
-   dirlist[amount].Name=strdup(DirEntry->d_name);
-   //printf("%c%s%c\n", (IsFile[amount]==false)?'[':' ',dirlist[amount],(IsFile[amount]==false)?']':' ');
-   amount++;
-  }
- }
- closedir(Directory);
-
- //sort directory and filenames
- PutString(FilerPosX+listX,FilerPosY+listY+ListSizeY/2,"Please wait. Sorting filenames... 00%");   
-  SDL_UpdateRect(screen,FilerPosX*CharSizeX,FilerPosY*CharSizeY,FilerSizeX*CharSizeX,FilerSizeY*CharSizeY);
- for (i=0;i<amount;i++)
- {
-  first=i;
-  for (j=i+1;j<amount;j++) if (dirlist[j].IsFile<dirlist[first].IsFile || (dirlist[j].IsFile==dirlist[first].IsFile && cmpstr(dirlist[j].Name,dirlist[first].Name)<0 ) ) first=j;
-  if (first!=i) { entrytmp=dirlist[i]; dirlist[i]=dirlist[first]; dirlist[first]=entrytmp; }
-  put2digit(FilerPosX+listX+34,FilerPosY+listY+ListSizeY/2,i*100/amount);
- }
- PutString(FilerPosX+listX,FilerPosY+listY+ListSizeY/2,"",42);
+ DirScanStart(); //the entries are read & sorted in the rounds of the control-loop, the list shows them as they come
 
  //control (keyhandler) loop---------------------
  bool selected=false;
  while (!selected)
  {
-  SDL_PumpEvents();
+  while (OverlayPoll(&event)); //the keys are read from their states
   keystate = SDL_GetKeyState(NULL);
   SHIFTstate = (keystate[SDLK_LSHIFT] || keystate[SDLK_RSHIFT]);
-  if (keystate[SDLK_ESCAPE]) { WaitKeyRelease(); return 0; }
+  if (DirScan())
+  { //new entries merged in, the cursor stays on its entry
+   current=(dirpos+fcurpos<amount)? DirList[DirShown[dirpos+fcurpos]].Name : "";
+   DirFilter(); amount=DirShown.size();
+   for (i=0;i<amount && DirList[DirShown[i]].Name!=current;i++);
+   if (i<amount && (i<dirpos || i>=dirpos+ListSizeY)) { dirpos=(i>fcurpos)? i-fcurpos : 0; fcurpos=i-dirpos; }
+   else if (i<amount) fcurpos=i-dirpos;
+  }
+  if (keystate[SDLK_ESCAPE]) { WaitKeyRelease(); DirScanStop(); OverlayClose(); return 0; }
   else if (keystate[SDLK_LEFT])
   {
    if (repeatex()==0) if (typepos>0) typepos--;
@@ -2293,7 +4474,7 @@ REREADIR:
     if (fmode==0)
     {
      if(dirpos+fcurpos<amount-1) { if(fcurpos<ListSizeY-1) fcurpos++; else dirpos++; }
-     if (dirlist[dirpos+fcurpos].IsFile) {strcpy(FileName,dirlist[dirpos+fcurpos].Name); typepos=strlen(FileName);}
+     if (dirpos+fcurpos<amount && DirList[DirShown[dirpos+fcurpos]].IsFile) {strcpy(FileName,DirList[DirShown[dirpos+fcurpos]].Name.c_str()); typepos=strlen(FileName);}
     }
     else { if (selplace<placemax-1) selplace++; }
    }
@@ -2305,7 +4486,7 @@ REREADIR:
     if (fmode==0)
     {
      if(fcurpos>0) fcurpos--; else {if(dirpos>0)dirpos--;}
-     if (dirlist[dirpos+fcurpos].IsFile) {strcpy(FileName,dirlist[dirpos+fcurpos].Name); typepos=strlen(FileName);}
+     if (dirpos+fcurpos<amount && DirList[DirShown[dirpos+fcurpos]].IsFile) {strcpy(FileName,DirList[DirShown[dirpos+fcurpos]].Name.c_str()); typepos=strlen(FileName);}
     }
     else { if (selplace>0) selplace--;}
    }
@@ -2315,7 +4496,7 @@ REREADIR:
    if (repeatex()==0) 
    { 
     for (i=0;i<8;i++) if(dirpos+fcurpos<amount-1) {if(fcurpos<ListSizeY-1) fcurpos++; else dirpos++;}
-    if (dirlist[dirpos+fcurpos].IsFile) {strcpy(FileName,dirlist[dirpos+fcurpos].Name); typepos=strlen(FileName);}
+    if (dirpos+fcurpos<amount && DirList[DirShown[dirpos+fcurpos]].IsFile) {strcpy(FileName,DirList[DirShown[dirpos+fcurpos]].Name.c_str()); typepos=strlen(FileName);}
    }
   }
   else if (keystate[SDLK_PAGEUP])
@@ -2323,7 +4504,7 @@ REREADIR:
    if (repeatex()==0) 
    { 
     for (i=0;i<8;i++) if(fcurpos>0)fcurpos--; else if(dirpos>0)dirpos--;
-    if (dirlist[dirpos+fcurpos].IsFile) {strcpy(FileName,dirlist[dirpos+fcurpos].Name); typepos=strlen(FileName);}
+    if (dirpos+fcurpos<amount && DirList[DirShown[dirpos+fcurpos]].IsFile) {strcpy(FileName,DirList[DirShown[dirpos+fcurpos]].Name.c_str()); typepos=strlen(FileName);}
    }
   }
   else if (keystate[SDLK_HOME]) { if (repeatex()==0) { if (fcurpos) fcurpos=0; else dirpos=0;} }
@@ -2341,7 +4522,7 @@ REREADIR:
    {
     if (fmode==0)
     { //load file / enter dir
-     if (!dirlist[dirpos+fcurpos].IsFile && dirpos+fcurpos>0) { chdir(dirlist[dirpos+fcurpos].Name); goto REREADIR; }
+     if (dirpos+fcurpos<amount && !DirList[DirShown[dirpos+fcurpos]].IsFile && DirList[DirShown[dirpos+fcurpos]].Name!=".") { chdir(DirList[DirShown[dirpos+fcurpos]].Name.c_str()); goto REREADIR; }
      else { WaitKeyRelease(); selected=true; } // strcpy(FileName,dirlist[dirpos+fcurpos].Name); }
     }
     else
@@ -2353,7 +4534,7 @@ REREADIR:
   else if (keystate[SDLK_TAB]) {if (repeatex()==0) fmode=(fmode)?0:1;}
   else if (keystate[SDLK_BACKSPACE])
   {
-   if (repeatex()==0) if (typepos>0) {typepos--; for(i=typepos;i<strlen(FileName);i++) FileName[i]=FileName[i+1];} 
+   if (repeatex()==0) if (typepos>0) {typepos--; for(i=typepos;i<strlen(FileName);i++) FileName[i]=FileName[i+1]; TypeFilter(&dirpos,&fcurpos,&amount);} 
   }
   else if (NameKeyVal()!=0xFF)
   {
@@ -2363,25 +4544,31 @@ REREADIR:
     {
      for (i=FILENAME_LENGTH_MAX;i>=typepos;i--) FileName[i+1]=FileName[i];
      FileName[typepos] = (!SHIFTstate) ? NameKeyChar[NameKeyVal()] : ShiftNameKeyChar[NameKeyVal()]  ;  
-     typepos++; 
+     typepos++; TypeFilter(&dirpos,&fcurpos,&amount);
     }
    }
   }
-  else repecnt=repspd1;
+  else RepeatTime=0;
  
   //Display Directory Entries
   for (i=0;i<ListSizeY;i++)
   {
    if (i+dirpos<amount)
    {
+    FileEntry &entry=DirList[DirShown[i+dirpos]];
     PutChar(FilerPosX+listX-1,FilerPosY+listY+i,(fcurpos==i && fmode==0)?'>':' ',0,0);
-    if(!dirlist[i+dirpos].IsFile) PutChar(FilerPosX+listX,FilerPosY+listY+i,27,0,0);
+    if(!entry.IsFile) PutChar(FilerPosX+listX,FilerPosY+listY+i,27,0,0);
     else PutChar(FilerPosX+listX,FilerPosY+listY+i,' ',0,0); 
-    PutString(FilerPosX+listX+1-dirlist[i+dirpos].IsFile,FilerPosY+listY+i,dirlist[i+dirpos].Name,42);
-    if(!dirlist[i+dirpos].IsFile && strlen(dirlist[i+dirpos].Name)<42) PutChar(FilerPosX+listX+strlen(dirlist[i+dirpos].Name)+1,FilerPosY+listY+i,29,0,0); 
+    PutString(FilerPosX+listX+1-entry.IsFile,FilerPosY+listY+i,entry.Name,42);
+    if(!entry.IsFile && entry.Name.size()<42) PutChar(FilerPosX+listX+entry.Name.size()+1,FilerPosY+listY+i,29,0,0); 
    }
-   //else PutString(FilerPosX+listX+1,FilerPosY+listY+i,"...");
+   else PutString(FilerPosX+listX-1,FilerPosY+listY+i,"",44); //the filtered list may be shorter
   }
+  //Display the reading of the folder / the filtered amount
+  if (DirScanning) sprintf(status,"reading %6u",(unsigned int)DirList.size());
+  else if (FileFilter[0]) sprintf(status,"%6u/%-6u",amount,(unsigned int)DirList.size());
+  else sprintf(status,"%6u items",amount);
+  PutString(FilerPosX+FilerSizeX-16,FilerPosY+3,status,14);
   //Display Place-selector arrow
   for (i=0;i<placemax;i++) PutString(FilerPosX+1,FilerPosY+listY+2+PlacePos[i],(selplace==i && fmode==1)?"->":"  ");
   //Display Typed/Selected filename
@@ -2391,19 +4578,18 @@ REREADIR:
   curcount--; if (curcount<=0) {curcount=flashspd; flashstate^=0x80;}
   SDL_UpdateRect(screen,FilerPosX*CharSizeX,FilerPosY*CharSizeY,FilerSizeX*CharSizeX,FilerSizeY*CharSizeY);
 
-  SDL_Delay(12);
+  OverlayWait(12);
  }
 
  //SetTimer();
+ DirScanStop(); OverlayClose();
  return 1;
 }
 
 //------------------------------------------------------------------------
-unsigned char IDtemp[TrackerIDsize+1]="";
 
 int LoadTune()
 {
- RemoveTimer();
 tryload:
  if (FileSelector("Please select tune (.mit/.mid) to load.")==0) {InitGUI(); SetTimer();return 0;} //if (AlertBox("Really Load? Y/N")==0) {InitGUI(); SetTimer();return 0;}
  TuneFile=fopen(FileName,"rb"); // !!!important "wb" is for binary (not to check text-control characters)
@@ -2417,73 +4603,95 @@ tryload:
  return 0;
 }
 
-int LoadTuneFile() //needs TuneFile opened
-{
+bool ReadTuneID(FILE *file)
+{ //check file-header for matching type-ID (the indexer-thread reads tunes too)
+ unsigned char id[TrackerIDsize+1]="";
+ fread(id,TrackerIDsize,sizeof(unsigned char),file); id[TrackerIDsize]=0;
+ return !strcmp((const char*)id,(const char*)TRACKERID);
+}
+
+bool ReadTuneData(FILE *file, TuneData &tune)
+{ //settings, sequences, patterns & instruments after the type-ID into a (cleared) tune, false if the file was cut short
  int i,j,k,readata=0,seqlength=MaxSeqLength;
- //check file-header for matching type-ID
- fread(IDtemp,TrackerIDsize,sizeof(unsigned char),TuneFile); IDtemp[TrackerIDsize]=0;
- if ( strcmp((const char*)IDtemp,(const char*)TRACKERID) )
- {
-  fclose(TuneFile); InitGUI();
-  if (AlertBox("Not Supported File Type to load! Select other? Y/N")==0) { InitGUI(); SetTimer(); return 1; }
-  else {return 2;}
- }
- InitMusicData(false);
  //get file-header with settings
- fread(TUNESETTING,TuneSettingSize,sizeof(unsigned char),TuneFile);
- UsedInPort=TUNESETTING[TUNE_MIDIPORTIN]; SetInDevice(UsedInPort); 
- HiLight=TUNESETTING[TUNE_HIGHLIGHT]; if (HiLight==0) HiLight=1; //avoid division by zero
- AutoFollow=TUNESETTING[TUNE_AUTOFOLLOW];
+ fread(tune.Setting,TuneSettingSize,sizeof(unsigned char),file);
 
  //get default instruments
- for (i=0;i<TUNESETTING[TUNE_CHANAMOUNT];i++) { DefaultIns[i]=fgetc(TuneFile); } //Default instrument setting for all channels
+ for (i=0;i<tune.Setting[TUNE_CHANAMOUNT];i++) { readata=fgetc(file); if (i<TrackAmount) tune.DefaultIns[i]=readata; } //Default instrument setting for all channels
 
  //get orderlist (sequences)
- for (i=0;i<TUNESETTING[TUNE_CHANAMOUNT];i++)
+ for (i=0;i<tune.Setting[TUNE_CHANAMOUNT];i++)
  {
-  seqlength=fgetc(TuneFile); //size of sequence
+  seqlength=fgetc(file); //size of sequence
   for (j=0;j<MaxSeqLength && j<seqlength;j++)
   {
-   readata=fgetc(TuneFile);
+   readata=fgetc(file);
    //if (readata!=0xFF) 
-   SEQUENCE[i][j]=readata; 
+   if (i<TrackAmount) tune.Sequence[i][j]=readata; 
    //else break;
   }
-  fgetc(TuneFile); //the checking 0xFF
+  fgetc(file); //the checking 0xFF
  }
 
  //get patterns
- if (TUNESETTING[TUNE_PTNAMOUNT])
+ if (tune.Setting[TUNE_PTNAMOUNT])
  {
-  for (i=0; i<MaxPtnAmount && i<=TUNESETTING[TUNE_PTNAMOUNT]; i++)
+  for (i=0; i<MaxPtnAmount && i<=tune.Setting[TUNE_PTNAMOUNT]; i++)
   {
-   readata=fgetc(TuneFile); //Size of pattern
-   //if (readata==EOF) break;
-   PATTLENG[i]=readata;
+   readata=fgetc(file); //Size of pattern
+   if (readata==EOF) break;
+   tune.PattLeng[i]=readata;
    for (k=0;k<readata;k++)
    {
-    for (j=0;j<TUNESETTING[TUNE_PTNCOLUMNS];j++)
+    for (j=0;j<tune.Setting[TUNE_PTNCOLUMNS];j++)
     {
-     PATTERNS[i][j][k]=fgetc(TuneFile);
+     if (j<PtnColumns) tune.Patterns[i][k][j]=fgetc(file); else fgetc(file); //columns of a later version are skipped
     }
    }
   }
  }
 
  //get instruments
- if (TUNESETTING[TUNE_INSTAMOUNT])
+ if (tune.Setting[TUNE_INSTAMOUNT])
  {
-  for (i=0; i<MaxInstAmount && i<TUNESETTING[TUNE_INSTAMOUNT];i++)
+  for (i=0; i<MaxInstAmount && i<tune.Setting[TUNE_INSTAMOUNT];i++)
   {
    //if (readata==EOF) break;
    for (j=0;j<InstrumSize;j++)
    {
-    INSTRUMENT[i][j]=fgetc(TuneFile); 
+    tune.Instrument[i][j]=fgetc(file); 
    }
   }
  }
- fclose(TuneFile);
- InitRoutine(true); ResetPos(); PlayMode=0; SetSelPatt();
+ return !feof(file);
+}
+
+bool ReadTuneData(FILE *file)
+{ //the same into the (cleared) music-data
+ static TuneData read;
+ bool complete;
+ memcpy(read.Setting,TUNESETTING,TuneSettingSize); ClearTune(read);
+ complete=ReadTuneData(file,read); SwapTune(read);
+ return complete;
+}
+
+int LoadTuneFile() //needs TuneFile opened
+{
+ SetlistCancel(); SetlistPos=NextLoaded=-1; SetlistWait=0; //a tune loaded by hand leaves the setlist
+ if (!ReadTuneID(TuneFile))
+ {
+  fclose(TuneFile); InitGUI();
+  if (AlertBox("Not Supported File Type to load! Select other? Y/N")==0) { InitGUI(); SetTimer(); return 1; }
+  else {return 2;}
+ }
+ KUSS(); //the playing tune is left
+ InitMusicData(false);
+ ReadTuneData(TuneFile);
+ UsedInPort=TUNESETTING[TUNE_MIDIPORTIN]; SetInDevice(UsedInPort); 
+ HiLight=TUNESETTING[TUNE_HIGHLIGHT]; if (HiLight==0) HiLight=1; //avoid division by zero
+ AutoFollow=TUNESETTING[TUNE_AUTOFOLLOW];
+ fclose(TuneFile); CompileRoutes();
+ InitRoutine(true); ResetPos(); PlayMode=0; SetSelPatt(); DirtyTune();
  InitGUI(); //Display();
  SetTimer();
  return 0;
@@ -2495,12 +4703,538 @@ inline bool fexists (const std::string& name)
  else return false;
 }
 
+//---------------------------------------------------------------------------------
+//------------------------------ SONG-LIBRARY --------------------------------------------------
+//The folders of the rig-profile's 'library' lines are read in the background (a slice in every round of the main
+//loop), the new/changed tunes are read and measured by the indexer-thread on its own music-data (the live tune and
+//player are never touched). The index is cached in LIBRARY_FILE by path, modification-time and size, so only
+//new/changed tunes are read again. On Linux inotify tells the changes.
+void LibraryRead(const std::string &path, LibraryEntry &entry, TuneData &tune)
+{ //indexer-thread: metadata of a tune: header-settings, tracks used, instrument-names, length by the player's timing
+ FILE *file=fopen(path.c_str(),"rb"); unsigned char head[14]; char name[InstrumSize-INST_NAME+1]; int i,j;
+ entry.Frames=TIMELINE_UNKNOWN; entry.Tracks=entry.Patterns=entry.Instrs=0; entry.Instruments.clear();
+ if (file==NULL) return;
+ if (ReadTuneID(file))
+ {
+  memset(tune.Setting,0,TuneSettingSize); ClearTune(tune); ReadTuneData(file,tune);
+  for (i=0;i<TrackAmount;i++) if (tune.Sequence[i][0]!=ORDERLIST_FX_END) entry.Tracks++;
+  entry.Patterns=tune.Setting[TUNE_PTNAMOUNT]; entry.Instrs=tune.Setting[TUNE_INSTAMOUNT];
+  for (i=0;i<MaxInstAmount && i<entry.Instrs;i++)
+  { //named instruments (the dots of an unnamed one cut)
+   for (j=0;j<InstrumSize-INST_NAME && tune.Instrument[i][INST_NAME+j];j++) name[j]=(strchr("\t\r\n,",tune.Instrument[i][INST_NAME+j]))? ' ' : tune.Instrument[i][INST_NAME+j];
+   while (j>0 && (name[j-1]=='.' || name[j-1]==' ')) j--;
+   name[j]=0; if (j==0) continue;
+   if (entry.Instruments.size()) entry.Instruments+=", ";
+   entry.Instruments+=name;
+  }
+  entry.Frames=MeasureTune(tune);
+ }
+ else
+ { //MIDI-file: the tracks of its header (MThd, length, format, tracks, division), it's not measured
+  rewind(file);
+  if (fread(head,1,14,file)==14 && !memcmp(head,"MThd",4)) entry.Tracks=(head[10])? 0xFF : head[11];
+ }
+ fclose(file);
+}
+
+void LibraryRemove(const std::string &path)
+{
+ std::map<std::string,unsigned int>::iterator found=LibraryIndex.find(path);
+ unsigned int i;
+ if (found==LibraryIndex.end()) return;
+ i=found->second; LibraryIndex.erase(found);
+ if (i+1<LIBRARY.size()) { LIBRARY[i]=LIBRARY.back(); LibraryIndex[LIBRARY[i].Path]=i; }
+ LIBRARY.pop_back(); LibraryDirty=true; LibraryChanges++;
+}
+
+int LibraryWorker(void *unused)
+{ //indexer-thread: reads the queued tunes one by one
+ static TuneData tune;
+ LibraryEntry entry;
+ SDL_LockMutex(LibraryLock);
+ while (!LibraryQuit)
+ {
+  if (LibraryJobs.empty()) { SDL_CondWait(LibrarySignal,LibraryLock); continue; }
+  entry=LibraryJobs.front(); LibraryJobs.pop_front();
+  SDL_UnlockMutex(LibraryLock);
+  LibraryRead(entry.Path,entry,tune);
+  SDL_LockMutex(LibraryLock);
+  LibraryResults.push_back(entry);
+ }
+ SDL_UnlockMutex(LibraryLock);
+ return 0;
+}
+
+void LibraryStop()
+{
+ if (LibraryThread==NULL) return;
+ SDL_LockMutex(LibraryLock); LibraryQuit=true; SDL_CondSignal(LibrarySignal); SDL_UnlockMutex(LibraryLock);
+ SDL_WaitThread(LibraryThread,NULL); LibraryThread=NULL;
+}
+
+bool LibraryCheck(const std::string &path)
+{ //the tune is given to the indexer-thread if it's new or changed, true if it was
+ struct stat st;
+ std::map<std::string,unsigned int>::iterator found=LibraryIndex.find(path);
+ LibraryEntry entry;
+ if (stat(path.c_str(),&st)!=0) { LibraryRemove(path); return false; }
+ if (found!=LibraryIndex.end())
+ {
+  LibraryEntry &known=LIBRARY[found->second];
+  known.Seen=true;
+  if (known.Mtime==(long long)st.st_mtime && known.Size==(long long)st.st_size) return false;
+ }
+ entry.Path=path; entry.Mtime=st.st_mtime; entry.Size=st.st_size; entry.Seen=true;
+ if (LibraryThread==NULL) LibraryThread=SDL_CreateThread(LibraryWorker,NULL);
+ SDL_LockMutex(LibraryLock); LibraryJobs.push_back(entry); SDL_CondSignal(LibrarySignal); SDL_UnlockMutex(LibraryLock);
+ LibraryQueued++;
+ return true;
+}
+
+void LibraryCollect()
+{ //the tunes read by the indexer-thread go into the index
+ std::deque<LibraryEntry> results;
+ std::map<std::string,unsigned int>::iterator found;
+ struct stat st;
+ unsigned int i;
+ SDL_LockMutex(LibraryLock); results.swap(LibraryResults); SDL_UnlockMutex(LibraryLock);
+ for (i=0;i<results.size();i++)
+ {
+  LibraryEntry &entry=results[i];
+  LibraryQueued--;
+  if (stat(entry.Path.c_str(),&st)!=0) continue; //deleted meanwhile
+  found=LibraryIndex.find(entry.Path);
+  if (found!=LibraryIndex.end()) LIBRARY[found->second]=entry;
+  else { LibraryIndex[entry.Path]=LIBRARY.size(); LIBRARY.push_back(entry); }
+  LibraryDirty=true; LibraryChanges++;
+ }
+}
+
+void LibrarySave()
+{ //the index-cache: a line for every tune: mtime size frames tracks patterns instruments <TAB> path <TAB> instrument-names
+ FILE *cache=fopen(LibraryCache.c_str(),"w"); unsigned int i;
+ LibraryDirty=false;
+ if (cache==NULL) return;
+ fprintf(cache,"MIDItrk-library 1\n");
+ for (i=0;i<LIBRARY.size();i++)
+ {
+  LibraryEntry &entry=LIBRARY[i];
+  fprintf(cache,"%lld %lld %u %u %u %u\t%s\t%s\n",entry.Mtime,entry.Size,entry.Frames,entry.Tracks,entry.Patterns,entry.Instrs,entry.Path.c_str(),entry.Instruments.c_str());
+ }
+ fclose(cache);
+}
+
+void LibraryWatch(const std::string &folder)
+{ //changes of the folder are told by inotify
+#ifdef __linux__
+ int watch;
+ if (LibraryNotify<0) return;
+ watch=inotify_add_watch(LibraryNotify,folder.c_str(),IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_DELETE|IN_CREATE);
+ if (watch>=0) LibraryWatches[watch]=folder;
+#endif
+}
+
+void LibraryNotified()
+{ //changes in the watched folders: written/moved-in tunes are read again, deleted ones dropped, new folders read
+#ifdef __linux__
+ char buffer[4096] __attribute__ ((aligned(8))), *p;
+ struct inotify_event *event;
+ std::string path; unsigned int i;
+ int length;
+ if (LibraryNotify<0) return;
+ while ((length=read(LibraryNotify,buffer,sizeof(buffer)))>0)
+ {
+  for (p=buffer; p<buffer+length; p+=sizeof(struct inotify_event)+event->len)
+  {
+   event=(struct inotify_event*)p;
+   if (!event->len || LibraryWatches.find(event->wd)==LibraryWatches.end()) continue;
+   path=LibraryWatches[event->wd]+"/"+event->name;
+   if (event->mask&IN_ISDIR)
+   {
+    if (event->mask&(IN_CREATE|IN_MOVED_TO)) LibraryFolders.push_back(path);
+    else for (i=LIBRARY.size();i>0;i--) if (!LIBRARY[i-1].Path.compare(0,path.size()+1,path+"/")) LibraryRemove(LIBRARY[i-1].Path);
+   }
+   else if (!TuneExtension(event->name)) continue;
+   else if (event->mask&(IN_DELETE|IN_MOVED_FROM)) LibraryRemove(path);
+   else LibraryPending.push_back(path);
+  }
+ }
+#endif
+}
+
+void LibraryRescan()
+{ //a whole pass over the library-folders, tunes not found any more are dropped at its end
+ unsigned int i;
+ if (LibraryScanning) return;
+ for (i=0;i<LIBRARY.size();i++) LIBRARY[i].Seen=false;
+ LibraryFolders=LibraryRoots; LibraryScanning=true;
+}
+
+void LibraryLoad()
+{ //the index-cache from the last run, then the folders are checked for changes
+ FILE *cache; char line[4096], *path, *names; LibraryEntry entry;
+ if (LibraryRoots.empty()) return;
+ cache=fopen(LibraryCache.c_str(),"r");
+ if (cache!=NULL)
+ {
+  if (fgets(line,sizeof(line),cache) && !strncmp(line,"MIDItrk-library 1",17))
+  while (fgets(line,sizeof(line),cache))
+  {
+   unsigned int tracks, patterns, instrs;
+   if ((path=strchr(line,'\t'))==NULL || (names=strchr(path+1,'\t'))==NULL) continue;
+   *path++=0; *names++=0; names[strcspn(names,"\r\n")]=0;
+   if (sscanf(line,"%lld %lld %u %u %u %u",&entry.Mtime,&entry.Size,&entry.Frames,&tracks,&patterns,&instrs)!=6) continue;
+   entry.Tracks=tracks; entry.Patterns=patterns; entry.Instrs=instrs; entry.Path=path; entry.Instruments=names; entry.Seen=false;
+   LibraryIndex[entry.Path]=LIBRARY.size(); LIBRARY.push_back(entry);
+  }
+  fclose(cache);
+ }
+#ifdef __linux__
+ LibraryNotify=inotify_init1(IN_NONBLOCK);
+#endif
+ if (LibraryLock==NULL) { LibraryLock=SDL_CreateMutex(); LibrarySignal=SDL_CreateCond(); }
+ LibraryRescan();
+ printf("Song-library: %u tunes in the index-cache, checking %u folders\n",(unsigned int)LIBRARY.size(),(unsigned int)LibraryRoots.size());
+}
+
+void LibraryBackground()
+{ //a slice of indexing: the results of the indexer-thread, the tunes told by inotify, then the next entries of the folders
+ struct dirent *DirEntry; struct stat st; std::string path; int i;
+ if (LibraryRoots.empty()) return;
+ LibraryCollect(); LibraryNotified();
+ while (LibraryPending.size() && LibraryQueued<LIBRARY_QUEUE) { path=LibraryPending.back(); LibraryPending.pop_back(); LibraryCheck(path); }
+ for (i=0;i<LIBRARY_SLICE && LibraryQueued<LIBRARY_QUEUE;i++)
+ {
+  if (LibraryDir==NULL)
+  {
+   if (LibraryFolders.empty())
+   {
+    if (LibraryScanning)
+    { //the pass ended: what wasn't found is gone
+     LibraryScanning=false;
+     for (i=LIBRARY.size();i>0;i--) if (!LIBRARY[i-1].Seen) LibraryRemove(LIBRARY[i-1].Path);
+    }
+    if (LibraryDirty && !LibraryQueued) LibrarySave();
+    return;
+   }
+   LibraryPath=LibraryFolders.back(); LibraryFolders.pop_back();
+   if ((LibraryDir=opendir(LibraryPath.c_str()))!=NULL) LibraryWatch(LibraryPath);
+   continue;
+  }
+  if ((DirEntry=readdir(LibraryDir))==NULL) { closedir(LibraryDir); LibraryDir=NULL; continue; }
+  if (!strcmp(DirEntry->d_name,".") || !strcmp(DirEntry->d_name,"..")) continue;
+  path=LibraryPath+"/"+DirEntry->d_name;
+  if (!EntryIsFile(LibraryDir,DirEntry,path.c_str()))
+  { //linked folders are not followed (no endless loops)
+#ifdef DT_UNKNOWN
+   if (DirEntry->d_type==DT_LNK || (DirEntry->d_type==DT_UNKNOWN && lstat(path.c_str(),&st)==0 && S_ISLNK(st.st_mode))) continue;
+#endif
+   LibraryFolders.push_back(path); continue;
+  }
+  if (TuneExtension(DirEntry->d_name)) LibraryCheck(path);
+ }
+}
+
+bool LibraryMatch(LibraryEntry &entry, const char *query)
+{ //every word of the query: '<'/'>' minutes[.seconds] compares the length, other words are looked for in the path & instrument-names
+ char word[FILENAME_LENGTH_MAX+8]; unsigned int minutes, seconds, frames; int length;
+ while (*query)
+ {
+  while (*query==' ') query++;
+  for (length=0; query[length] && query[length]!=' '; length++) word[length]=query[length];
+  word[length]=0; query+=length;
+  if (length==0) break;
+  if (word[0]=='<' || word[0]=='>')
+  {
+   minutes=seconds=0; sscanf(word+1,"%u%*[.,:]%u",&minutes,&seconds); frames=(minutes*60+seconds)*50;
+   if (entry.Frames==TIMELINE_UNKNOWN || (word[0]=='<' && entry.Frames>=frames) || (word[0]=='>' && entry.Frames<=frames)) return false;
+  }
+  else if (!NameMatches(entry.Path.c_str(),word) && !NameMatches(entry.Instruments.c_str(),word)) return false;
+ }
+ return true;
+}
+
+bool LibraryLess(unsigned int a, unsigned int b) { return cmpstr((char*)LIBRARY[a].Path.c_str(),(char*)LIBRARY[b].Path.c_str())<0; }
+
+PlayerSnapshot PreviewState; int PreviewPlayMode, PreviewSlots; bool PreviewFollow;
+ChannelState PreviewSynth[CHANNEL_SLOTS]; //what the ports had from the current tune when the preview started
+
+void PreviewStop()
+{ //the current tune is back with its player-state and synth-settings
+ if (!Previewing) return;
+ KUSS(); SwapTune(SpareTune); CompileRoutes();
+ LoadSnapshot(PreviewState);
+ memset(&PreviewSynth[PreviewSlots],CHANNEL_UNKNOWN,(CHANNEL_SLOTS-PreviewSlots)*sizeof(ChannelState)); //slots taken by the preview aren't set back
+ ChannelRestore(PreviewSynth);
+ PlayMode=PreviewPlayMode; FollowPlay=PreviewFollow; EndOfTune=(TracksPlaying==0); Previewing=false;
+}
+
+void PreviewStart(const std::string &path)
+{ //play a tune of the library without touching the current one (that waits in the spare music-data)
+ FILE *file=fopen(path.c_str(),"rb"); int i;
+ PreviewStop();
+ if (file==NULL) return;
+ if (!ReadTuneID(file)) { fclose(file); return; }
+ KUSS(); TimelineStop(); SaveSnapshot(PreviewState); PreviewPlayMode=PlayMode; PreviewFollow=FollowPlay;
+ memcpy(PreviewSynth,SynthState,sizeof(PreviewSynth)); PreviewSlots=SlotAmount;
+ SwapTune(SpareTune); ClearTuneData(); ReadTuneData(file); fclose(file); CompileRoutes();
+ ResetPlayerState(true); ShaperReset(FILTER_LIVE); FollowPlay=false;
+ for (i=0;i<TrackAmount;i++) { SelectIns(PLAYEDINS[i]); SetVolume(PLAYEDINS[i],0x7F); }
+ PlayMode=1; EndOfTune=false; Previewing=true;
+}
+
+int LibraryBrowser()
+{ //Shift+F8: search the song-library by name/folder, instrument-names or length; ENTER loads the tune, TAB previews it
+ static int i, FilerSizeX=62, FilerPosX=(WinSizeX/CharSizeX)/2-FilerSizeX/2, FilerPosY=1, FilerSizeY=WinSizeY/CharSizeY-2;
+ static const int listX=2, listY=7, infoY=FilerSizeY-7, typerY=FilerSizeY-3, ListSizeY=infoY-listY-1;
+ static char query[FILENAME_LENGTH_MAX+8]="";
+ static int listpos=0, curpos=0;
+ std::vector<unsigned int> found; unsigned int shown=(unsigned int)-1, amount=0;
+ std::string path, previewed; char line[80]; bool selected=false;
+ int typepos=strlen(query), load;
+ OverlayOpen(); //the tune plays on under it (till a preview takes the player)
+ if (LibraryNotify<0) LibraryRescan(); //without inotify the changes are found by reading the folders again
+ WaitKeyRelease();
+ while (!selected)
+ {
+  LibraryBackground();
+  if (shown!=LibraryChanges)
+  { //the list of the matching tunes, the cursor stays on its tune
+   path=(curpos+listpos<(int)amount)? LIBRARY[found[curpos+listpos]].Path : "";
+   found.clear(); for (i=0;i<(int)LIBRARY.size();i++) if (LibraryMatch(LIBRARY[i],query)) found.push_back(i);
+   std::sort(found.begin(),found.end(),LibraryLess); amount=found.size(); shown=LibraryChanges;
+   for (i=0;i<(int)amount && LIBRARY[found[i]].Path!=path;i++);
+   if (i==(int)amount) i=(curpos+listpos<(int)amount)? curpos+listpos : 0;
+   if (i<listpos || i>=listpos+ListSizeY) listpos=(i>curpos)? i-curpos : 0;
+   curpos=i-listpos;
+  }
+  if (Previewing && EndOfTune) PreviewStop(); //the preview is played by the player-thread
+  while (OverlayPoll(&event)); //the keys are read from their states
+  keystate = SDL_GetKeyState(NULL);
+  SHIFTstate = (keystate[SDLK_LSHIFT] || keystate[SDLK_RSHIFT]);
+  if (keystate[SDLK_ESCAPE]) { WaitKeyRelease(); PreviewStop(); OverlayClose(); InitGUI(); return 0; }
+  else if (keystate[SDLK_DOWN]) { if (repeatex()==0 && curpos+listpos+1<(int)amount) { if (curpos<ListSizeY-1) curpos++; else listpos++; } }
+  else if (keystate[SDLK_UP]) { if (repeatex()==0) { if (curpos>0) curpos--; else if (listpos>0) listpos--; } }
+  else if (keystate[SDLK_PAGEDOWN]) { if (repeatex()==0) for (i=0;i<8;i++) if (curpos+listpos+1<(int)amount) { if (curpos<ListSizeY-1) curpos++; else listpos++; } }
+  else if (keystate[SDLK_PAGEUP]) { if (repeatex()==0) for (i=0;i<8;i++) { if (curpos>0) curpos--; else if (listpos>0) listpos--; } }
+  else if (keystate[SDLK_HOME]) { if (repeatex()==0) curpos=listpos=0; }
+  else if (keystate[SDLK_END]) { if (repeatex()==0 && amount) { listpos=((int)amount>ListSizeY)? amount-ListSizeY : 0; curpos=amount-1-listpos; } }
+  else if (keystate[SDLK_TAB])
+  { //preview the tune under the cursor / stop the preview
+   if (repeatex()==0 && curpos+listpos<(int)amount)
+   {
+    path=LIBRARY[found[curpos+listpos]].Path;
+    if (Previewing && path==previewed) PreviewStop(); else { PreviewStart(path); previewed=path; }
+   }
+  }
+  else if (keystate[SDLK_RETURN])
+  {
+   if (repeatex()==0 && curpos+listpos<(int)amount)
+   { //load it like F8, from its folder
+    WaitKeyRelease(); PreviewStop(); OverlayClose();
+    path=LIBRARY[found[curpos+listpos]].Path;
+    if (path.rfind('/')!=std::string::npos) { chdir(path.substr(0,path.rfind('/')).c_str()); path=path.substr(path.rfind('/')+1); }
+    strncpy(FileName,path.c_str(),FILENAME_LENGTH_MAX); FileName[FILENAME_LENGTH_MAX]=0;
+    TuneFile=fopen(path.c_str(),"rb");
+    if (TuneFile==NULL) { InitGUI(); if (AlertBox("Error Opening file! Try again? Y/N")==0) { InitGUI(); return 1; } }
+    else if ((load=LoadTuneFile())!=2) return load;
+    WaitKeyRelease(); OverlayOpen();
+   }
+  }
+  else if (keystate[SDLK_BACKSPACE])
+  {
+   if (repeatex()==0 && typepos>0) { typepos--; query[typepos]=0; shown--; }
+  }
+  else if (NameKeyVal()!=0xFF)
+  {
+   if (repeatex()==0 && typepos<FILENAME_LENGTH_MAX)
+   { query[typepos++]=(!SHIFTstate) ? NameKeyChar[NameKeyVal()] : ShiftNameKeyChar[NameKeyVal()]; query[typepos]=0; shown--; }
+  }
+  else RepeatTime=0;
+
+  //Display frame, list of the found tunes (length, tracks, name), info of the selected one, search-words
+  for (i=0;i<FilerSizeY;i++)
+  {
+   if (i==0 || i==FilerSizeY-1) PutString(FilerPosX,i+FilerPosY,"+@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@+");
+   else if (i==listY-2 || i==infoY || i==typerY-1) PutString(FilerPosX,i+FilerPosY,"]@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@]");
+   else { PutChar(FilerPosX,i+FilerPosY,']',0,0); PutChar(FilerPosX+FilerSizeX-1,i+FilerPosY,']',0,0); }
+  }
+  PutString(FilerPosX+1,FilerPosY+1,"",FilerSizeX-2); PutString(FilerPosX+1,FilerPosY+2,"",FilerSizeX-2); PutString(FilerPosX+1,FilerPosY+3,"",FilerSizeX-2);
+  PutString(FilerPosX+FilerSizeX/2-12,FilerPosY+1,"Song-library (Shift+F8)");
+  PutString(FilerPosX+1,FilerPosY+2,"TAB: preview/stop  ENTER: load  ESC: exit");
+  PutString(FilerPosX+1,FilerPosY+3,"Search: name/folder, instrument, <min.sec, >min.sec");
+  if (LibraryRoots.empty()) strcpy(line,"No 'library <folder>' lines in " RIG_FILE);
+  else sprintf(line,"%u/%u tunes%s",amount,(unsigned int)LIBRARY.size(),(LibraryScanning || LibraryDir || LibraryPending.size() || LibraryQueued)?", indexing...":"");
+  PutString(FilerPosX+1,FilerPosY+4,line,FilerSizeX-2);
+  for (i=0;i<ListSizeY;i++)
+  {
+   if (i+listpos<(int)amount)
+   {
+    LibraryEntry &entry=LIBRARY[found[i+listpos]];
+    PutChar(FilerPosX+1,FilerPosY+listY+i,(curpos==i)?'>':' ',0,0);
+    PutFrameTime(FilerPosX+listX,FilerPosY+listY+i,entry.Frames);
+    sprintf(line," %2u ",entry.Tracks); PutString(FilerPosX+listX+5,FilerPosY+listY+i,line);
+    path=entry.Path.substr(entry.Path.rfind('/')+1);
+    PutString(FilerPosX+listX+9,FilerPosY+listY+i,path,FilerSizeX-listX-10);
+    if (Previewing && entry.Path==previewed) PutChar(FilerPosX+FilerSizeX-2,FilerPosY+listY+i,'*',0,0);
+   }
+   else PutString(FilerPosX+1,FilerPosY+listY+i,"",FilerSizeX-2);
+  }
+  for (i=1;i<=5;i++) PutString(FilerPosX+1,FilerPosY+infoY+i-(i>3),"",FilerSizeX-2);
+  if (curpos+listpos<(int)amount)
+  {
+   LibraryEntry &entry=LIBRARY[found[curpos+listpos]];
+   path=(entry.Path.size()>(unsigned int)FilerSizeX-2)? entry.Path.substr(entry.Path.size()-(FilerSizeX-2)) : entry.Path;
+   PutString(FilerPosX+1,FilerPosY+infoY+1,path,FilerSizeX-2);
+   sprintf(line,"Tracks:%u Patterns:%u Instruments:%u",entry.Tracks,entry.Patterns,entry.Instrs); PutString(FilerPosX+1,FilerPosY+infoY+2,line,FilerSizeX-2);
+   PutString(FilerPosX+1,FilerPosY+infoY+3,entry.Instruments,FilerSizeX-2);
+  }
+  PutString(FilerPosX+1,FilerPosY+typerY,"Search:");
+  PutString(FilerPosX+1,FilerPosY+typerY+1,query,FilerSizeX-2);
+  PutChar(FilerPosX+1+typepos,FilerPosY+typerY+1,' '+0x80,0,0); //typer-cursor
+  SDL_UpdateRect(screen,FilerPosX*CharSizeX,FilerPosY*CharSizeY,FilerSizeX*CharSizeX,FilerSizeY*CharSizeY);
+  OverlayWait(12);
+ }
+ OverlayClose();
+ return 0;
+}
+
+//---------------------------------------------------------------------------------
+//------------------------------ SETLIST ------------------------------------------------------
+//The next tune of the setlist is read into NextTune by a reader-thread while the current one plays, then checked by
+//the main loop, the patches of its start go out ahead on the channels the current tune doesn't use. It takes over in
+//the frame where the next row would be due at the boundary (end of the tune or an orderlist-position of the 1st
+//track), without stopping the player.
+TuneData NextTune;
+SDL_Thread *SetlistThread=NULL; SDL_mutex *SetlistLock=NULL; std::string SetlistPath; bool SetlistDone=false, SetlistValid=false; //reader-thread
+
+int SetlistReader(void *unused)
+{ //reader-thread: the tune-file of SetlistPath into NextTune
+ FILE *file=fopen(SetlistPath.c_str(),"rb"); bool valid=false;
+ if (file!=NULL)
+ {
+  if (ReadTuneID(file)) { memset(NextTune.Setting,0,TuneSettingSize); ClearTune(NextTune); valid=ReadTuneData(file,NextTune); }
+  fclose(file);
+ }
+ SDL_LockMutex(SetlistLock); SetlistValid=valid; SetlistDone=true; SDL_UnlockMutex(SetlistLock);
+ return 0;
+}
+
+void SetlistRead(int pos)
+{ //start reading a tune of the setlist
+ if (SetlistLock==NULL) SetlistLock=SDL_CreateMutex();
+ SetlistReading=pos; SetlistPath=SETLIST[pos].Path; SetlistDone=false;
+ SetlistThread=SDL_CreateThread(SetlistReader,NULL);
+}
+
+void SetlistCancel()
+{ //the tune being read is dropped (waits for the reader-thread)
+ if (SetlistReading<0) return;
+ SDL_WaitThread(SetlistThread,NULL); SetlistThread=NULL; SetlistReading=-1; SetlistGo=false;
+}
+
+bool SetlistPreload(bool valid)
+{ //the tune read into NextTune is checked, false if it can't be played
+ int i, j, layer, tracks=0;
+ unsigned short used[PortAmount];
+ if (!valid) return false;
+ memset(used,0,sizeof(used)); //channels of the current tune: routed by an instrument or having notes sounding
+ for (i=0;i<MaxInstAmount;i++) if ((INSTRUMENT[i][0] || INSTRUMENT[i][1] || INSTRUMENT[i][2]) && ROUTE[i].Port<PortAmount) used[ROUTE[i].Port]|=1<<ROUTE[i].Channel;
+ SDL_LockMutex(OutputLock);
+ for (i=0;i<PortAmount;i++) for (j=0;j<16;j++) if (SOUNDING[i][j][0] || SOUNDING[i][j][1] || SOUNDING[i][j][2] || SOUNDING[i][j][3]) used[i]|=1<<j;
+ SDL_UnlockMutex(OutputLock);
+ SwapTune(NextTune); CompileRoutes();
+ for (i=0;i<TrackAmount;i++) if (SEQUENCE[i][0]!=ORDERLIST_FX_END) tracks++;
+ if (tracks==0) valid=false;
+ if (valid) for (i=0;i<TrackAmount;i++) if (SEQUENCE[i][0]!=ORDERLIST_FX_END) for (j=0;j<ROUTE[DefaultIns[i]].Layers;j++)
+ { //patches of the starting instruments on the idle channels (the switch doesn't send them again: the synth-state knows them)
+  layer=ROUTE[DefaultIns[i]].Layer[j];
+  if (!INSTRUMENT[layer][0] && !INSTRUMENT[layer][1] && !INSTRUMENT[layer][2]) continue;
+  if (ROUTE[layer].Port>=PortAmount || used[ROUTE[layer].Port]&(1<<ROUTE[layer].Channel)) continue;
+  PlayerMessage.push_back(0xC0+ROUTE[layer].Channel); PlayerMessage.push_back(INSTRUMENT[layer][INST_PATCH]-1);
+  CarefulMessage(layer);
+ }
+ SwapTune(NextTune); CompileRoutes();
+ return valid;
+}
+
+void SetlistBackground()
+{ //the next playable tune of the setlist is preloaded once per setlist-position
+ int pos; bool done, valid;
+ if (Previewing) return; //the preview has the music-data
+ if (SetlistReading>=0)
+ { //the read tune is checked, an unplayable one is skipped
+  SDL_LockMutex(SetlistLock); done=SetlistDone; valid=SetlistValid; SDL_UnlockMutex(SetlistLock);
+  if (!done) return;
+  SDL_WaitThread(SetlistThread,NULL); SetlistThread=NULL; pos=SetlistReading; SetlistReading=-1;
+  if (SetlistPreload(valid))
+  {
+   NextLoaded=pos;
+   if (SetlistGo) { SetlistGo=false; SetlistNext(); }
+   return;
+  }
+  printf("Setlist: %s can't be played, skipped\n",SETLIST[pos].Path.c_str());
+  if (pos+1<(int)SETLIST.size()) SetlistRead(pos+1); else SetlistGo=false;
+  return;
+ }
+ if (SetlistPos<0 || NextLoaded>=0 || SetlistChecked==SetlistPos) return;
+ SetlistChecked=SetlistPos;
+ if (SetlistPos+1<(int)SETLIST.size()) SetlistRead(SetlistPos+1);
+}
+
+void SetlistSwitch()
+{ //the preloaded tune takes over: notes of the last one are stopped, the player is at the start of the new one
+ int i; size_t slash;
+ for (i=0;i<TrackAmount;i++) TrackNotesOff(i);
+ TimelineStop(); LaunchClear(); SwapTune(NextTune); CompileRoutes();
+ HiLight=TUNESETTING[TUNE_HIGHLIGHT]; if (HiLight==0) HiLight=1; //avoid division by zero
+ AutoFollow=TUNESETTING[TUNE_AUTOFOLLOW];
+ if (UsedInPort!=TUNESETTING[TUNE_MIDIPORTIN]) { UsedInPort=TUNESETTING[TUNE_MIDIPORTIN]; SetInDevice(UsedInPort); }
+ ResetPlayerState(true); if (PlayMode>0) ClockRewind(); //the clock-slaves are told the start of the new tune
+ for (i=0;i<TrackAmount;i++) { SelectIns(PLAYEDINS[i]); SetVolume(PLAYEDINS[i],0x7F); SPDCNT[i]++; } //the first rows are due in this frame
+ SetlistPos=NextLoaded; NextLoaded=-1; SetlistWait=0; EndOfTune=false;
+ slash=SETLIST[SetlistPos].Path.rfind('/'); slash=(slash==std::string::npos)? 0 : slash+1;
+ strncpy(FileName,SETLIST[SetlistPos].Path.c_str()+slash,FILENAME_LENGTH_MAX); FileName[FILENAME_LENGTH_MAX]=0;
+ ResetPos(); SetSelPatt(); DirtyTune(); Display();
+ printf("Setlist: %d. %s\n",SetlistPos+1,SETLIST[SetlistPos].Path.c_str());
+}
+
+void SetlistNext()
+{ //Alt+F8: the next tune of the setlist at once (the setlist starts again if a tune was loaded by hand)
+ if (SetlistPos<0 && NextLoaded<0 && SetlistReading<0 && SETLIST.size()) SetlistRead(0);
+ if (NextLoaded<0) { SetlistGo=(SetlistReading>=0); return; } //when it's read
+ if (PlayMode>0) SetlistWait=1; else SetlistSwitch(); //while playing it happens in the next frame
+}
+
+void SetlistFrame()
+{ //before a frame: the switch when its time has come, then the position to compare with after the frame
+ if (SetlistPos<0 || Previewing || ExportMode) return;
+ if (SetlistWait && --SetlistWait==0) SetlistSwitch();
+ SetlistSeq=SEQCNT[0]; SetlistTracks=TracksPlaying;
+}
+
+void SetlistArm()
+{ //after a frame: the last row before the boundary has just started, the switch comes when its length has passed
+ int k, at; unsigned int clock;
+ if (SetlistPos<0 || NextLoaded<0 || SetlistWait || Previewing || ExportMode || PlayMode!=1) return;
+ at=SETLIST[SetlistPos].Switch;
+ if (at==SETLIST_END)
+ { //the row of the track that ended last
+  if (TracksPlaying || !SetlistTracks) return;
+  for (k=0;!(SetlistTracks&(1<<k));k++);
+ }
+ else if (SEQCNT[0]==at && SetlistSeq!=at) k=0;
+ else return;
+ if (BPM[k]) { clock=(ROWCLOCK[k]<ROWLENGTH[k])? ROWCLOCK[k] : 0; SetlistWait=(ROWLENGTH[k]-clock+ROWCLOCK_FRAME-1)/ROWCLOCK_FRAME; }
+ else SetlistWait=TEMPO[k]+2;
+ if (SetlistWait==0) SetlistWait=1;
+}
+
 //---------------------------------------------------------------------------------
 int SaveTune()
 {
  int i,j,k,maxptn=0,maxinst=0,seqlength=MaxSeqLength;
  unsigned char SeqTemp[MaxSeqLength];
- RemoveTimer();
  if (strcmp(FilExt(FileName),".mit")) ChangeExt(FileName,".mit"); // add/correct extension
 trysave:
  if (FileSelector("Please give folder & filename (.mit) to save tune.")==0) {InitGUI(); SetTimer();return 0;} //if (AlertBox("Really Save? Y/N")==0) { InitGUI(); SetTimer(); return 0;}
@@ -2519,10 +5253,11 @@ trysave:
  }
 
  TUNESETTING[TUNE_CHANAMOUNT]=TrackAmount;
- TUNESETTING[TUNE_PTNCOLUMNS]=PtnColumns;
  for (i=0;i<TrackAmount;i++) for (j=0;j<MaxSeqLength;j++) if(SEQUENCE[i][j]>maxptn && SEQUENCE[i][j]<ORDERLIST_FX_MIN) maxptn=SEQUENCE[i][j];
  TUNESETTING[TUNE_PTNAMOUNT]=maxptn;
- for(maxinst=MaxInstAmount-1;maxinst>=0;maxinst--) if (INSTRUMENT[maxinst][INST_PORT]!=0 || INSTRUMENT[maxinst][INST_CHVOL]!=0 || INSTRUMENT[maxinst][INST_PATCH]!=0) break;
+ TUNESETTING[TUNE_PTNCOLUMNS]=PTN_CHORD; //a tune without chords is saved in the 3-column format of earlier versions
+ for (i=0;i<=maxptn;i++) for (k=0;k<PATTLENG[i];k++) for (j=PTN_CHORD;j<PtnColumns;j++) if (PATTERNS[i][k][j]) TUNESETTING[TUNE_PTNCOLUMNS]=PtnColumns;
+ for(maxinst=MaxInstAmount-1;maxinst>=0;maxinst--) { for (j=0;j<INST_NAME && INSTRUMENT[maxinst][j]==0;j++); if (j<INST_NAME) break; }
  maxinst++;
  TUNESETTING[TUNE_INSTAMOUNT]=maxinst;
  TUNESETTING[TUNE_MIDIPORTIN]=UsedInPort;
@@ -2558,9 +5293,9 @@ trysave:
    fputc(PATTLENG[i],TuneFile); //Size of pattern
    for (k=0;k<PATTLENG[i];k++)
    {
-    for (j=0;j<PtnColumns;j++)
+    for (j=0;j<TUNESETTING[TUNE_PTNCOLUMNS];j++)
     {
-     fputc(PATTERNS[i][j][k],TuneFile);
+     fputc(PATTERNS[i][k][j],TuneFile);
     }
    }
   }
@@ -2600,17 +5335,33 @@ int BEwordToFile(unsigned int DataToWrite) //put word in big-endian to output-fi
 unsigned int MIDItrackPointer[TrackAmount]={0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
 unsigned int DeltaCount[TrackAmount]={0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
 unsigned int PPQN=0x60,PALpulses=PPQN/(4*6),RowDelta;
+unsigned int PulseRate, PulseFraction; //MIDI-pulses of a 20ms frame and the fraction left over in 1/65536 pulses (BPM-tempo)
 unsigned char TrackTemp[TrackAmount][65536]; //pattern is collected here before writing to file, because size must be detected beforehand
+unsigned char TempoTrack[65536]; unsigned int TempoPointer=0, TempoDelta=0; int ExportBPM; //conductor-track with the tempo-map
+
+void DeltaToTrack(unsigned char *track, unsigned int &pointer, unsigned int delta)
+{ //write VARIABLE LENTGH (!) MIDI delta-timing value
+ if (delta>(128*128-1)) { track[pointer]=((delta&0x1FC000)/0x4000)|0x80; pointer++; }  
+ if (delta>0x7F) { track[pointer]=((delta&0x3F80)/128)|0x80; pointer++; }
+ track[pointer]=delta&0x7F; pointer++;
+}
+
+void TempoToExport()
+{ //tempo meta-event (FF 51) for the actual BPM of the tune, frame-based tempo is exported as PALpulses per frame
+ unsigned int micros=(TuneBPM)? 60000000/TuneBPM : 20000*PPQN/PALpulses; //microseconds per quarter-note (beat)
+ DeltaToTrack(TempoTrack,TempoPointer,TempoDelta); TempoDelta=0;
+ TempoTrack[TempoPointer++]=0xFF; TempoTrack[TempoPointer++]=0x51; TempoTrack[TempoPointer++]=3;
+ TempoTrack[TempoPointer++]=micros>>16; TempoTrack[TempoPointer++]=(micros>>8)&0xFF; TempoTrack[TempoPointer++]=micros&0xFF;
+ PulseRate=(TuneBPM)? (PPQN*TuneBPM*65536)/3000 : PALpulses*65536; //3000 frames in a minute
+ ExportBPM=TuneBPM;
+}
 
 void MessageToExport(unsigned char instr)
 { //route PlayerMessage vector to MIDI-file export
  int i;
- unsigned char channel=INSTRUMENT[instr][INST_CHVOL]/16;
+ unsigned char channel=ROUTE[instr].Channel;
 
- //write VARIABLE LENTGH (!) MIDI delta-timing value
- if (DeltaCount[channel]>(128*128-1)) { TrackTemp[channel][MIDItrackPointer[channel]]=((DeltaCount[channel]&0x1FC000)/0x4000)|0x80; MIDItrackPointer[channel]++; }  
- if (DeltaCount[channel]>0x7F) { TrackTemp[channel][MIDItrackPointer[channel]]=((DeltaCount[channel]&0x3F80)/128)|0x80; MIDItrackPointer[channel]++; }
- TrackTemp[channel][MIDItrackPointer[channel]]=DeltaCount[channel]&0x7F; MIDItrackPointer[channel]++;
+ DeltaToTrack(TrackTemp[channel],MIDItrackPointer[channel],DeltaCount[channel]);
  
  for (i=0;i<PlayerMessage.size();i++)
  {   TrackTemp[channel][MIDItrackPointer[channel]]=PlayerMessage.at(i); MIDItrackPointer[channel]++; } 
@@ -2621,8 +5372,8 @@ void MessageToExport(unsigned char instr)
 
 int ExportMIDI()
 {
- int i,j,trackamount;
- RemoveTimer();
+ int i,trackamount,playmode; unsigned int j; bool follow,fromstart,timeline;
+ PlayerSnapshot live;
  if (strcmp(FilExt(FileName),".mid")) ChangeExt(FileName,".mid"); // add/correct extension
 tryexport:
  if (FileSelector("Please give folder & filename to export MIDI.")==0) {InitGUI(); SetTimer();return 0;} //if (AlertBox("Export MIDI? Y/N")==0) {InitGUI(); SetTimer(); return 0;}
@@ -2641,21 +5392,29 @@ tryexport:
   else {goto tryexport;}
  }
 
+ playmode=PlayMode; follow=FollowPlay; fromstart=PlayedFromStart; timeline=TimelinePlaying; //the player is lent to the export, the playback goes on after it
+ KUSS(); if (playmode>0) ClockTransport(MIDI_STOP); //the player-thread is held while it renders: no hung notes, the clock-slaves wait
+ TimelineStop(); SaveSnapshot(live);
  ExportMode=true; PlayMode=TrkPos=seqpos=0; //all MIDI-out data of the player-routine will be catched by the exporter 
  InitGUI(); //will show process
  
  //assemble MIDI track chunks
- RowDelta=PALpulses; //init tune-tempo
+ RowDelta=PALpulses; PulseFraction=0; //init tune-tempo
  for (i=0;i<TrackAmount;i++) MIDItrackPointer[i]=DeltaCount[i]=0; //init
- FollowPlay=false; InitRoutine(true); //init tune
+ TempoPointer=TempoDelta=0; ExportBPM=-1;
+ memset(ExportState,CHANNEL_UNKNOWN,sizeof(ExportState)); MessagesSent[FILTER_EXPORT]=MessagesSaved[FILTER_EXPORT]=MessagesThinned[FILTER_EXPORT]=0; //the file starts with unknown synth-state
+ FollowPlay=false; InitRoutine(true); TimelineStart(); //init tune, the events are read from the compiled timeline
  EndOfTune=false; 
  while (!EndOfTune)
  {
   PlayRoutine();
+  if (ExportBPM!=TuneBPM) TempoToExport(); //the new tempo counts from this frame
+  PulseFraction+=PulseRate; RowDelta=PulseFraction/65536; PulseFraction%=65536; //fraction is kept, no drift
   for (i=0;i<TrackAmount;i++) DeltaCount[i]+=RowDelta;
+  TempoDelta+=RowDelta;
  }
  
- trackamount=0; for (i=0;i<TrackAmount;i++) if (MIDItrackPointer[i]>0) trackamount++;
+ trackamount=1; for (i=0;i<TrackAmount;i++) if (MIDItrackPointer[i]>0) trackamount++; //+1: conductor-track
 
  //write MIDI header chunk
  fputs(MIDI_ID,MIDIfile);       //put MIDI-ID to the output-file
@@ -2664,6 +5423,9 @@ tryexport:
  BEwordToFile(trackamount);     //number of separate MIDI tracks
  BEwordToFile(PPQN);             //PPQN - MIDI pulses per quarter-note
  //write MIDI track chunks
+ fputs(MIDI_TRACK_ID,MIDIfile); BEwordToFile(0);BEwordToFile(TempoPointer+4); //conductor-track with the tempo-map first
+ for(j=0;j<TempoPointer;j++) fputc(TempoTrack[j],MIDIfile);
+ fputc(0,MIDIfile);fputc(0xFF,MIDIfile);fputc(0x2F,MIDIfile); fputc(0,MIDIfile);
  for (i=0;i<TrackAmount;i++)
  {
   if (MIDItrackPointer[i]>0) 
@@ -2675,8 +5437,13 @@ tryexport:
   }
  }
  fclose(MIDIfile);
+ std::cout << "\nMIDI-export: " << MessagesSent[FILTER_EXPORT] << " messages written, " << MessagesSaved[FILTER_EXPORT] << " redundant ones left out, " << MessagesThinned[FILTER_EXPORT] << " pitch-wheel/controller values thinned.\n";
  
- InitRoutine(true); ExportMode=false; PlayerMessage.clear(); Display();
+ LoadSnapshot(live); PlayMode=playmode; FollowPlay=follow; PlayedFromStart=fromstart; EndOfTune=(TracksPlaying==0);
+ if (timeline) TimelineStart();
+ ExportMode=false; PlayerMessage.clear(); Display();
+ if (playmode>0) ClockTransport(MIDI_CONTINUE); //the slaves go on from the song-position
+ PlayerTicks=SDL_GetTicks(); //no catch-up of the frames the export took
  SetTimer();
  return 0;
 }
@@ -2739,19 +5506,55 @@ int EnumDevices()
   return 0;
 }
 
+void MIDIwake()
+{ //MIDI-thread: the main loop is woken to handle the input at once (a single wake-event queued at a time)
+ SDL_Event event;
+ SDL_LockMutex(InputLock);
+ if (!WakePending)
+ {
+  event.type = SDL_USEREVENT;
+  event.user.code = WAKEEVENT_CODE;
+  event.user.data1 = event.user.data2 = NULL;
+  WakePending=(SDL_PushEvent(&event)==0); //a full queue: the next input tries again
+ }
+ SDL_UnlockMutex(InputLock);
+ SDL_CondSignal(PlayerSignal); //the player-thread follows the clock/timecode at once
+}
+
+void WakeTaken()
+{ //main-thread: the wake-event is taken, the next input pushes a new one
+ SDL_LockMutex(InputLock); WakePending=false; SDL_UnlockMutex(InputLock);
+}
+
 void MIDIcallback( double deltatime, std::vector< unsigned char > *message, void *userData )
 {
  unsigned int nBytes = message->size();
  unsigned char previnote;
+ SDL_LockMutex(InputLock);
+ InputTime+=deltatime*1000; //the slave's PLL runs on the timing of the input
+ if (nBytes>0 && message->at(0)>=0xF0) 
+ {
+  if (SlaveMode==SLAVE_CLOCK) ClockInput(message->at(0),message); else if (SlaveMode==SLAVE_MTC) MtcInput(message);
+  SDL_UnlockMutex(InputLock); MIDIwake(); message->clear(); return; //the slave follows between the frames too
+ }
+ SDL_UnlockMutex(InputLock);
  if (nBytes>0) 
  {
   //connecting input with output caused freezes, should be worked around later for polyphonic jamming:
   //try{ PortOut[INSTRUMENT[SelInst][INST_PORT]]->sendMessage( message ); } catch( RtError &error ) {error.printMessage();}
  
+  if (LaunchChannel>=0 && nBytes>2 && (message->at(0)&0xF0)==0x90 && message->at(2) && (message->at(0)&0xF)>=LaunchChannel && (message->at(0)&0xF)-LaunchChannel<TrackAmount)
+  { //a pad of the launch-channels: queued by the main thread
+   SDL_LockMutex(InputLock);
+   if (LaunchInboxIn-LaunchInboxOut<LAUNCH_INBOX) { LaunchInbox[LaunchInboxIn%LAUNCH_INBOX]=((message->at(0)&0xF)-LaunchChannel)*256+message->at(1); LaunchInboxIn++; }
+   SDL_UnlockMutex(InputLock);
+   MIDIwake(); message->clear(); return;
+  }
   if ((int)message->at(0)==0x90 && (int)message->at(2)!=0x00 ) { DispNote=(int)message->at(1)+1; previnote=DispNote;}
   else if ((int)message->at(0)==0x80) DispNote=0; //&& (int)message->at(1)+1==prevnote) DispNote=0;
   else if ((int)message->at(0)==0x90) DispNote=0; //&& (int)message->at(1)+1==prevnote && (int)message->at(2)==0x00 ) DispNote=0;
   else if ((int)message->at(0)==0xC0) {MIDIselInst=(int)message->at(1); } //don't call DispInstr(), due to thread-safeness
+  MIDIwake();
  }
  message->clear();
 }
@@ -2777,35 +5580,33 @@ void ResetPos()
 
 int AlertBox(const char* text)
 {
- int i;
  //RemoveTimer();
  int AlertX=(WinSizeX/2)/CharSizeX-strlen(text)/2, AlertY=(WinSizeY/2)/CharSizeY-3;
  
  //PlayMode=0; FollowPlay=false; StopTime=SDL_GetTicks();
- for (i=0;i<TrackAmount;i++) { if (prevnote[i]>0) NoteOff(PLAYEDINS[i],prevnote[i],0); AllNotesOff (PLAYEDINS[i]);}
+ OverlayOpen();
  
  for (int i=0;i<strlen(text)+6;i++) for (int j=0;j<7;j++) PutChar(AlertX+i-3,AlertY+j-3,' ',0,0);
  PutString(AlertX,AlertY,text); 
  
  SDL_UpdateRect(screen, 0, 0, 0, 0);
- SDL_PollEvent(&event);
  bool decide=false; int Answer=0;
  
   while (decide==false)
   {
-   SDL_PollEvent(&event);
+   OverlayEvent(&event);
    if ( event.type == SDL_KEYDOWN && event.key.keysym.sym==SDLK_y ) {decide=true; Answer=1;}
    if ( event.type == SDL_KEYDOWN && event.key.keysym.sym==SDLK_n ) {decide=true; Answer=0;}
-   SDL_Delay(5);
   }
 
  while (event.type != SDL_KEYUP) //(keystate[SDLK_y] || keystate[SDLK_n]) ; //wait to release keys
  {
-   SDL_PollEvent(&event);
+  OverlayEvent(&event);
   //keystate = SDL_GetKeyState(NULL); SDL_Delay(5);
  }
  
  //SetTimer(); 
+ OverlayClose();
  Display();
  
  return Answer;
@@ -2819,12 +5620,11 @@ void WaitKeyPress()
 
 void WaitKeyRelease()
 {
- RemoveTimer();
- while (SDL_PollEvent(&event)) //wait to release keys
+ while (OverlayPoll(&event)) //wait to release keys
  {
   if ( event.type == SDL_KEYUP && (event.key.keysym.sym==SDLK_ESCAPE || event.key.keysym.sym==SDLK_RETURN) ) break;
  }
- SDL_Delay(100);
+ OverlayWait(100);
 }
 
 void WaitButtonRelease() //wait to release mouse button